@@ -0,0 +1,277 @@
+/*
+ * arenabench.c - Benchmark for the bump-pointer regions of mm-arena.c
+ *
+ * Simulates a server that handles one request after another. Each request
+ * allocates a random number of objects, most of them small and a few up to
+ * a few KiB, writes to both ends of each, and then drops them all. The same
+ * requests are run twice against a fresh heap:
+ *
+ *   malloc  every object comes from mm_malloc and goes back to mm_free,
+ *           in the order it was allocated
+ *   region  every object comes from mm_arena_alloc, and one call to
+ *           mm_arena_reset (or, with -c, mm_arena_destroy on a region made
+ *           for the request) drops them all
+ *
+ * A number of long-lived blocks, some of which are replaced between
+ * requests, keep the heap from being empty when a request starts.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "mm-arena.h"
+#include "mm.h"
+
+/* Defaults for the command line options */
+#define DEFAULT_REQUESTS 20000 /* requests per run */
+#define DEFAULT_OBJECTS 500    /* average objects per request */
+#define DEFAULT_LIVE 1000      /* long-lived blocks */
+#define DEFAULT_REPS 3         /* runs of each mode, the fastest counts */
+#define SMALL_MAX 256          /* largest "small" object, in bytes */
+#define LARGE_MAX 4096         /* largest object, in bytes */
+#define LARGE_PERCENT 3        /* percentage of objects that may be large */
+#define CHURN 8                /* long-lived blocks replaced per request */
+
+typedef enum
+{
+    MODE_MALLOC,
+    MODE_REGION,
+    MODE_REGION_CREATE
+} bench_mode_t;
+
+/* Parameters of a run */
+typedef struct
+{
+    long requests;
+    int objects;
+    int live;
+    size_t block_size; /* region block size, 0 for the default */
+} params_t;
+
+/* Seconds elapsed on a monotonic clock */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* xorshift generator, so that every mode sees the same requests */
+static unsigned long next_random(unsigned long *state)
+{
+    unsigned long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/* Draw an object size: mostly small, sometimes large */
+static size_t random_size(unsigned long r)
+{
+    return ((r >> 32) % 100 < LARGE_PERCENT) ? 1 + (r >> 16) % LARGE_MAX
+                                             : 1 + (r >> 16) % SMALL_MAX;
+}
+
+/*
+ * run - Run every request in the given mode against a fresh heap, and set
+ *     *count to the number of objects allocated. Returns the elapsed time
+ *     in seconds, or a negative value on failure.
+ */
+static double run(bench_mode_t mode, const params_t *p, long *count)
+{
+    unsigned long state = 0x9E3779B97F4A7C15UL;
+    char **objs = calloc(2 * p->objects, sizeof(char *));
+    char **live = calloc(p->live + 1, sizeof(char *));
+    struct mm_arena *arena = NULL;
+    bool failed = false;
+    long i;
+    int k;
+
+    *count = 0;
+    if (objs == NULL || live == NULL)
+    {
+        fprintf(stderr, "calloc failed\n");
+        exit(1);
+    }
+
+    mem_reset_brk();
+    if (!mm_init())
+    {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+
+    double start = now();
+    for (k = 0; k < p->live; k++)
+    {
+        if ((live[k] = mm_malloc(random_size(next_random(&state)))) == NULL)
+            failed = true;
+    }
+    if (mode == MODE_REGION)
+        failed = (arena = mm_arena_create(p->block_size)) == NULL;
+
+    for (i = 0; i < p->requests && !failed; i++)
+    {
+        int n = 1 + (int)(next_random(&state) % (2 * p->objects));
+        *count += n;
+        if (mode == MODE_REGION_CREATE &&
+            (arena = mm_arena_create(p->block_size)) == NULL)
+        {
+            failed = true;
+            break;
+        }
+        for (k = 0; k < n; k++)
+        {
+            size_t size = random_size(next_random(&state));
+            objs[k] = mode == MODE_MALLOC ? mm_malloc(size)
+                                          : mm_arena_alloc(arena, size);
+            if (objs[k] == NULL)
+            {
+                failed = true;
+                n = k;
+                break;
+            }
+            /* Touch both ends of the object */
+            objs[k][0] = (char)k;
+            objs[k][size - 1] = (char)k;
+        }
+
+        if (mode == MODE_MALLOC)
+        {
+            for (k = 0; k < n; k++)
+                mm_free(objs[k]);
+        }
+        else if (mode == MODE_REGION)
+            mm_arena_reset(arena);
+        else
+            mm_arena_destroy(arena);
+
+        /* Replace a few long-lived blocks */
+        for (k = 0; k < CHURN && p->live > 0; k++)
+        {
+            unsigned long r = next_random(&state);
+            int s = (int)(r % p->live);
+            mm_free(live[s]);
+            if ((live[s] = mm_malloc(random_size(r))) == NULL)
+                failed = true;
+        }
+    }
+    if (mode == MODE_REGION)
+        mm_arena_destroy(arena);
+    for (k = 0; k < p->live; k++)
+        mm_free(live[k]);
+    double secs = now() - start;
+
+    if (!mm_checkheap(__LINE__))
+    {
+        fprintf(stderr, "mm_checkheap failed\n");
+        failed = true;
+    }
+    free(objs);
+    free(live);
+    return failed ? -1.0 : secs;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-hc] [-r <requests>] [-n <objects>] [-l <live>] "
+            "[-b <bytes>] [-R <reps>]\n",
+            prog);
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-c         Create and destroy a region per request "
+                    "instead of resetting one.\n");
+    fprintf(stderr, "\t-r <n>     Requests per run (default %d).\n",
+            DEFAULT_REQUESTS);
+    fprintf(stderr, "\t-n <n>     Average objects per request (default %d).\n",
+            DEFAULT_OBJECTS);
+    fprintf(stderr, "\t-l <n>     Long-lived blocks (default %d).\n",
+            DEFAULT_LIVE);
+    fprintf(stderr, "\t-b <bytes> Region block size (default 64 KiB).\n");
+    fprintf(stderr, "\t-R <n>     Runs of each mode (default %d).\n",
+            DEFAULT_REPS);
+}
+
+int main(int argc, char **argv)
+{
+    params_t p = {DEFAULT_REQUESTS, DEFAULT_OBJECTS, DEFAULT_LIVE, 0};
+    bench_mode_t region_mode = MODE_REGION;
+    int reps = DEFAULT_REPS;
+    double base_tput = 0.0;
+    int c;
+
+    while ((c = getopt(argc, argv, "hcr:n:l:b:R:")) != EOF)
+    {
+        switch (c)
+        {
+        case 'c':
+            region_mode = MODE_REGION_CREATE;
+            break;
+        case 'r':
+            p.requests = atol(optarg);
+            break;
+        case 'n':
+            p.objects = atoi(optarg);
+            break;
+        case 'l':
+            p.live = atoi(optarg);
+            break;
+        case 'b':
+            p.block_size = (size_t)atol(optarg);
+            break;
+        case 'R':
+            reps = atoi(optarg);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (p.requests < 1 || p.objects < 1 || p.live < 0 || reps < 1)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    mem_init(false);
+    printf("%-7s %10s %10s %9s %9s %9s %8s\n", "mode", "requests", "objects",
+           "secs", "Kops/s", "peak KiB", "speedup");
+    bench_mode_t modes[2] = {MODE_MALLOC, region_mode};
+    for (int m = 0; m < 2; m++)
+    {
+        double best = -1.0;
+        long count = 0;
+        for (int r = 0; r < reps; r++)
+        {
+            double secs = run(modes[m], &p, &count);
+            if (secs < 0)
+            {
+                printf("%-7s  failed\n", m == 0 ? "malloc" : "region");
+                mem_deinit();
+                exit(1);
+            }
+            if (best < 0 || secs < best)
+                best = secs;
+        }
+        double tput = count / (best * 1000.0);
+        if (m == 0)
+            base_tput = tput;
+        printf("%-7s %10ld %10ld %9.3f %9.0f %9zu %8.2f\n",
+               m == 0 ? "malloc" : "region", p.requests, count, best, tput,
+               mem_heap_peak() / 1024, tput / base_tput);
+    }
+    mem_deinit();
+    return 0;
+}
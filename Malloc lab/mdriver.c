@@ -28,6 +28,7 @@
 #include "config.h"
 #include "fcyc.h"
 #include "memlib.h"
+#include "mm-stats.h"
 #include "mm.h"
 #include "stree.h"
 
@@ -38,6 +39,7 @@
 /* Misc */
 #define MAXLINE 1024 /* max string size */
 #define HDRLINES 4   /* number of header lines in a trace file */
+#define MAX_BATCH 64 /* most requests combined into one batch call (-B) */
 #define LINENUM(i)                                                             \
     (i + HDRLINES + 1) /* cnvt trace request nums to linenums (origin 1) */
 
@@ -144,6 +146,8 @@ typedef struct
 
     /* defined only for the student malloc package */
     double util; /* space utilization for this trace (always 0 for libc) */
+    size_t heap_peak; /* largest heap size during the utilization run */
+    size_t heap_end;  /* heap size at the end of the utilization run */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -188,6 +192,14 @@ int verbose = REF_ONLY ? 0 : 1; /* global flag for verbose output */
 static int errors = 0; /* number of errs found when running student malloc */
 static bool onetime_flag = false;
 static bool tab_mode = false; /* Print output as tab-separated fields */
+static bool heap_mode = false; /* Print peak and final heap sizes (-H) */
+#if !REF_ONLY
+static bool batch_mode = false; /* Issue runs of requests as batches (-B) */
+static bool sized_mode = false; /* Free blocks with mm_free_sized (-S) */
+static size_t alignment = 0;    /* Align payloads to this many bytes (-a) */
+static bool stats_mode = false; /* Print mm_stats after each trace (-M) */
+static bool frag_mode = false;  /* Print heap fragmentation at peak (-F) */
+#endif
 /* If set, use sparse memory emulation */
 static bool sparse_mode = SPARSE_MODE;
 static size_t maxfill = SPARSE_MODE ? MAXFILL_SPARSE : MAXFILL;
@@ -230,6 +242,34 @@ static sum_stats_t global_mm_sum_stats;
 /* This function enables generating the set of trace files */
 static void add_tracefile(char *trace);
 
+#if !REF_ONLY
+/* Batch entry points of mm.c, which mm.h does not declare */
+size_t mm_malloc_batch(size_t size, size_t n, void **ptrs);
+void mm_free_batch(void **ptrs, size_t n);
+
+/* Size-aware entry points of mm.c, which mm.h does not declare either */
+void mm_free_sized(void *ptr, size_t size);
+size_t mm_malloc_usable_size(void *ptr);
+
+/* Aligned allocation entry point of mm.c */
+void *mm_aligned_alloc(size_t alignment, size_t size);
+
+/* Heap growth policy of mm.c (-g) */
+void mm_set_growth(unsigned int shift, size_t max_step);
+
+/* Prints the allocator's statistics, as kept by mm_stats (-M) */
+static void print_alloc_stats(const trace_t *trace);
+
+/* Prints how fragmented the heap is when a trace peaks (-F) */
+static void print_fragmentation(trace_t *trace, int tracenum, int peak_op);
+
+/* These functions combine runs of trace requests into batch calls */
+static int batch_length(const trace_t *trace, int opnum);
+static bool run_batch(trace_t *trace, int opnum, int n);
+static bool valid_batch(trace_t *trace, range_set_t *ranges, int opnum, int n,
+                        bool *allCheck);
+#endif
+
 /* these functions manipulate range sets */
 static range_set_t *new_range_set();
 static bool add_range(range_set_t *ranges, char *lo, size_t size,
@@ -242,6 +282,10 @@ static void init_random_data(void);
 static bool check_index(const trace_t *trace, int opnum, int index);
 static void randomize_block(trace_t *trace, int index);
 
+/* Allocate and free trace blocks the way the command line asks for */
+static void *alloc_payload(size_t size);
+static void free_payload(void *p, size_t size);
+
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename);
@@ -260,6 +304,7 @@ static void eval_mm_speed(void *ptr);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printheapsizes(int n, stats_t *stats);
 static void usage(char *prog);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3, 4)));
@@ -337,6 +382,8 @@ static void run_tests(int num_tracefiles, const char *tracedir,
             if (verbose > 1)
                 printf("efficiency, ");
             mm_stats[i].util = eval_mm_util(trace, i);
+            mm_stats[i].heap_peak = mem_heap_peak();
+            mm_stats[i].heap_end = mem_heapsize();
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
@@ -388,7 +435,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpCOVAlDT")) != EOF)
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:a:g:hpCOVAlDTHBSMF")) != EOF)
     {
         switch (c)
         {
@@ -449,6 +496,49 @@ int main(int argc, char **argv)
             tab_mode = true;
             break;
 
+        case 'H':
+            heap_mode = true;
+            break;
+
+        case 'B':
+            batch_mode = true;
+            break;
+
+        case 'S':
+            sized_mode = true;
+            break;
+
+        case 'M':
+            stats_mode = true;
+            break;
+
+        case 'F':
+            frag_mode = true;
+            break;
+
+        case 'a':
+            alignment = strtoul(optarg, NULL, 0);
+            if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+            {
+                fprintf(stderr, "Alignment must be a power of 2\n");
+                exit(1);
+            }
+            break;
+
+        case 'g': /* Heap growth policy, as <shift>[:<max bytes>] */
+        {
+            char *end;
+            unsigned long shift = strtoul(optarg, &end, 0);
+            size_t max_step = *end == ':' ? strtoul(end + 1, &end, 0) : 0;
+            if (*end != '\0')
+            {
+                usage(argv[0]);
+                exit(1);
+            }
+            mm_set_growth((unsigned int)shift, max_step);
+            break;
+        }
+
         case 'h': /* Print this message */
             usage(argv[0]);
             exit(0);
@@ -582,6 +672,11 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_global_tracefiles, mm_stats, &global_mm_sum_stats);
             printf("\n");
+            if (heap_mode)
+            {
+                printheapsizes(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
         }
     }
 
@@ -1193,13 +1288,24 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
             }
         }
 
+#if !REF_ONLY
+        int n = batch_mode ? batch_length(trace, i) : 1;
+        if (n > 1)
+        {
+            if (!valid_batch(trace, ranges, i, n, &allCheck))
+                return false;
+            i += n - 1;
+            continue;
+        }
+#endif
+
         switch (trace->ops[i].type)
         {
 
         case ALLOC: /* mm_malloc */
 
             /* Call the student's malloc */
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = alloc_payload(size)) == NULL)
             {
                 malloc_error(trace, i, "mm_malloc failed.");
                 return false;
@@ -1212,6 +1318,20 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
              */
             if (add_range(ranges, p, size, trace, i, index) == 0)
                 return false;
+#if !REF_ONLY
+            if (mm_malloc_usable_size(p) < size)
+            {
+                malloc_error(trace, i, "mm_malloc_usable_size too small.");
+                return false;
+            }
+            if (alignment != 0 && (unsigned long)p % alignment != 0)
+            {
+                malloc_error(trace, i,
+                             "Payload address (%p) not aligned to %zu bytes", p,
+                             alignment);
+                return false;
+            }
+#endif
 
             /* Remember region */
             trace->blocks[index] = p;
@@ -1253,6 +1373,13 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
             {
                 if (add_range(ranges, newp, size, trace, i, index) == 0)
                     return false;
+#if !REF_ONLY
+                if (mm_malloc_usable_size(newp) < size)
+                {
+                    malloc_error(trace, i, "mm_malloc_usable_size too small.");
+                    return false;
+                }
+#endif
             }
 
             /* Move the region from where it was.
@@ -1285,13 +1412,15 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
             if (index == -1)
             {
                 p = 0;
+                size = 0;
             }
             else
             {
                 p = trace->blocks[index];
+                size = trace->block_sizes[index];
                 remove_range(ranges, p);
             }
-            mm_free(p);
+            free_payload(p, size);
             break;
 
         default:
@@ -1307,10 +1436,10 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   largest size of the heap in bytes while running the student's
+ *   malloc package on the trace. The package may give memory back by
+ *   decrementing the brk pointer, so the current size of the heap can
+ *   be smaller than this; mem_heap_peak() keeps the high water mark.
  *
  *   A higher number is better: 1 is optimal.
  */
@@ -1321,6 +1450,8 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     size_t size, newsize, oldsize;
     size_t max_total_size = 0;
     size_t total_size = 0;
+    int peak_op = 0; /* the request after which total_size peaked */
+    double util;
     char *p;
     char *newp, *oldp;
 
@@ -1333,6 +1464,28 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 
     for (i = 0; i < trace->num_ops; i++)
     {
+#if !REF_ONLY
+        int n = batch_mode ? batch_length(trace, i) : 1;
+        if (n > 1)
+        {
+            if (trace->ops[i].type == ALLOC)
+                total_size += n * trace->ops[i].size;
+            else
+                for (int k = 0; k < n; k++)
+                    if ((index = trace->ops[i + k].index) >= 0)
+                        total_size -= trace->block_sizes[index];
+            if (!run_batch(trace, i, n))
+                app_error("trace %d: mm_malloc_batch failed in eval_mm_util",
+                          tracenum);
+            i += n - 1;
+            if (total_size > max_total_size)
+            {
+                max_total_size = total_size;
+                peak_op = i;
+            }
+            continue;
+        }
+#endif
         switch (trace->ops[i].type)
         {
 
@@ -1340,7 +1493,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             index = trace->ops[i].index;
             size = trace->ops[i].size;
 
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = alloc_payload(size)) == NULL)
             {
                 app_error("trace %d: mm_malloc failed in eval_mm_util",
                           tracenum);
@@ -1387,7 +1540,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 p = trace->blocks[index];
             }
 
-            mm_free(p);
+            free_payload(p, size);
 
             total_size -= size;
             break;
@@ -1398,15 +1551,25 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         }
 
         /* update the high-water mark */
-        max_total_size =
-            (total_size > max_total_size) ? total_size : max_total_size;
+        if (total_size > max_total_size)
+        {
+            max_total_size = total_size;
+            peak_op = i;
+        }
     }
 
+    util = (double)max_total_size / (double)mem_heap_peak();
 #if !REF_ONLY
     printf(".");
+    if (stats_mode)
+        print_alloc_stats(trace);
+    if (frag_mode)
+        print_fragmentation(trace, tracenum, peak_op);
+#else
+    (void)peak_op;
 #endif
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return util;
 }
 
 /*
@@ -1428,15 +1591,27 @@ static void eval_mm_speed(void *ptr)
 
     /* Interpret each trace request */
     for (i = 0; i < trace->num_ops; i++)
+    {
+#if !REF_ONLY
+        int n = batch_mode ? batch_length(trace, i) : 1;
+        if (n > 1)
+        {
+            if (!run_batch(trace, i, n))
+                app_error("mm_malloc_batch error in eval_mm_speed");
+            i += n - 1;
+            continue;
+        }
+#endif
         switch (trace->ops[i].type)
         {
 
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = alloc_payload(size)) == NULL)
                 app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
             break;
 
         case REALLOC: /* mm_realloc */
@@ -1448,6 +1623,7 @@ static void eval_mm_speed(void *ptr)
                 app_error("mm_realloc error in eval_mm_speed");
             setUBCheck(true);
             trace->blocks[index] = newp;
+            trace->block_sizes[index] = newsize;
             break;
 
         case FREE: /* mm_free */
@@ -1455,19 +1631,278 @@ static void eval_mm_speed(void *ptr)
             if (index < 0)
             {
                 block = 0;
+                size = 0;
             }
             else
             {
                 block = trace->blocks[index];
+                size = trace->block_sizes[index];
             }
-            mm_free(block);
+            free_payload(block, size);
             break;
 
         default:
             app_error("Nonexistent request type in eval_mm_speed");
         }
+    }
+}
+
+/*
+ * alloc_payload - Allocate size bytes with mm_malloc, or with
+ *     mm_aligned_alloc if -a was given.
+ */
+static void *alloc_payload(size_t size)
+{
+#if !REF_ONLY
+    if (alignment != 0)
+        return mm_aligned_alloc(alignment, size);
+#endif
+    return mm_malloc(size);
+}
+
+/*
+ * free_payload - Free p, whose last requested size was size, with mm_free,
+ *     or with mm_free_sized if -S was given.
+ */
+static void free_payload(void *p, size_t size)
+{
+#if !REF_ONLY
+    if (sized_mode)
+    {
+        mm_free_sized(p, size);
+        return;
+    }
+#else
+    (void)size;
+#endif
+    mm_free(p);
+}
+
+#if !REF_ONLY
+/*
+ * print_alloc_stats - Print the statistics that mm_stats reports at the end
+ *     of the utilization run of a trace.
+ */
+static void print_alloc_stats(const trace_t *trace)
+{
+    struct mm_stats st;
+    int i;
+
+    printf("\nAllocator statistics for %s:\n", trace->filename);
+    if (!mm_stats(&st))
+    {
+        printf("  not kept (mm.c was built without MM_STATS)\n");
+        return;
+    }
+    printf("  %zu splits, %zu coalesces, %zu extend_heap calls (%zu KB)\n",
+           st.splits, st.coalesces, st.extends, st.extend_bytes / 1024);
+    printf("  payload bytes: %zu live, %zu peak\n", st.live_bytes,
+           st.peak_bytes);
+    printf("  free blocks: %zu mini, %zu in the size tree\n", st.mini_length,
+           st.tree_length);
+
+    printf("  %5s %10s %10s %10s %10s\n", "class", "min size", "allocs",
+           "frees", "free now");
+    for (i = 0; i < MM_STATS_CLASSES; i++)
+    {
+        if (st.allocs[i] == 0 && st.frees[i] == 0 && st.list_length[i] == 0)
+            continue;
+        printf("  %5d %10zu %10zu %10zu %10zu\n", i, st.class_size[i],
+               st.allocs[i], st.frees[i], st.list_length[i]);
+    }
+
+    printf("  blocks seen per free-list search:");
+    for (i = 0; i < MM_STATS_PROBE_BUCKETS; i++)
+    {
+        if (i == 0)
+            printf(" 0: %zu", st.probes[i]);
+        else if (i == MM_STATS_PROBE_BUCKETS - 1)
+            printf(", %d+: %zu", 1 << (i - 1), st.probes[i]);
+        else if (i == 1)
+            printf(", 1: %zu", st.probes[i]);
+        else
+            printf(", %d-%d: %zu", 1 << (i - 1), (1 << i) - 1, st.probes[i]);
+    }
+    printf("\n");
+}
+
+/*
+ * print_fragmentation - Replay a trace for eval_mm_util, and print what
+ *     mm_fragmentation reports right after request peak_op, where the
+ *     requested bytes peaked. The replay makes the same calls as the run
+ *     that eval_mm_util measured, so it leaves the heap in the same state.
+ */
+static void print_fragmentation(trace_t *trace, int tracenum, int peak_op)
+{
+    struct mm_frag fr;
+    int i, k, index;
+    size_t size;
+    char *p;
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("trace %d: mm_init failed in print_fragmentation",
+                  tracenum);
+
+    for (i = 0; i < trace->num_ops; i++)
+    {
+        int n = batch_mode ? batch_length(trace, i) : 1;
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        if (n > 1)
+        {
+            if (!run_batch(trace, i, n))
+                app_error("trace %d: mm_malloc_batch failed in "
+                          "print_fragmentation", tracenum);
+            i += n - 1;
+        }
+        else if (trace->ops[i].type == ALLOC)
+        {
+            if ((p = alloc_payload(size)) == NULL)
+                app_error("trace %d: mm_malloc failed in print_fragmentation",
+                          tracenum);
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+        }
+        else if (trace->ops[i].type == REALLOC)
+        {
+            setUBCheck(false);
+            p = mm_realloc(trace->blocks[index], size);
+            setUBCheck(true);
+            if (p == NULL && size != 0)
+                app_error("trace %d: mm_realloc failed in print_fragmentation",
+                          tracenum);
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+        }
+        else if (index < 0)
+            free_payload(NULL, 0);
+        else
+            free_payload(trace->blocks[index], trace->block_sizes[index]);
+
+        if (i < peak_op || i - (n - 1) > peak_op)
+            continue;
+
+        mm_fragmentation(&fr);
+        printf("\nHeap fragmentation of %s after request %d, at its "
+               "peak:\n", trace->filename, i);
+        printf("  heap %zu KB: %zu KB in %zu allocated blocks, %zu KB in %zu "
+               "free blocks\n", fr.heap_bytes / 1024, fr.alloc_bytes / 1024,
+               fr.alloc_blocks, fr.free_bytes / 1024, fr.free_blocks);
+        printf("  largest free block %zu bytes, external fragmentation "
+               "%.1f%%\n", fr.largest_free, fr.external * 100);
+        printf("  free blocks by size:");
+        for (k = 0; k < MM_FRAG_BUCKETS; k++)
+        {
+            if (fr.size_hist[k] == 0)
+                continue;
+            if (k == MM_FRAG_BUCKETS - 1)
+                printf(" %zu+: %zu", (size_t)16 << k, fr.size_hist[k]);
+            else
+                printf(" %zu-%zu: %zu", (size_t)16 << k,
+                       ((size_t)32 << k) - 1, fr.size_hist[k]);
+        }
+        printf("\n  free blocks by list: mini: %zu", fr.mini_blocks);
+        for (k = 0; k < MM_STATS_CLASSES; k++)
+            if (fr.list_blocks[k] != 0)
+                printf(", %d: %zu", k, fr.list_blocks[k]);
+        printf(", tree: %zu\n", fr.tree_blocks);
+        if (fr.quick_blocks != 0)
+            printf("  freed but not coalesced yet: %zu KB in %zu blocks\n",
+                   fr.quick_bytes / 1024, fr.quick_blocks);
+    }
+}
+
+/*
+ * batch_length - Return how many requests, starting at opnum, -B issues as
+ *     one batch: a run of mallocs of the same size, or a run of frees, at
+ *     most MAX_BATCH long.
+ */
+static int batch_length(const trace_t *trace, int opnum)
+{
+    const traceop_t *op = &trace->ops[opnum];
+    int n = 1;
+
+    if (op->type == REALLOC || (op->type == ALLOC && alignment != 0))
+        return 1;
+    while (n < MAX_BATCH && opnum + n < trace->num_ops &&
+           op[n].type == op->type &&
+           (op->type == FREE || op[n].size == op->size))
+        n++;
+    return n;
+}
+
+/*
+ * run_batch - Issue the n requests starting at opnum, as found by
+ *     batch_length, with a single call to mm_malloc_batch or mm_free_batch.
+ *     Returns false if mm_malloc_batch allocated fewer than n blocks.
+ */
+static bool run_batch(trace_t *trace, int opnum, int n)
+{
+    const traceop_t *op = &trace->ops[opnum];
+    void *ptrs[MAX_BATCH];
+    int k;
+
+    if (op->type == ALLOC)
+    {
+        if (mm_malloc_batch(op->size, n, ptrs) < (size_t)n)
+            return false;
+        for (k = 0; k < n; k++)
+        {
+            trace->blocks[op[k].index] = ptrs[k];
+            trace->block_sizes[op[k].index] = op->size;
+        }
+    }
+    else
+    {
+        for (k = 0; k < n; k++)
+            ptrs[k] = op[k].index < 0 ? NULL : trace->blocks[op[k].index];
+        mm_free_batch(ptrs, n);
+    }
+    return true;
 }
 
+/*
+ * valid_batch - Run a batch for eval_mm_valid, with the same checks that
+ *     eval_mm_valid makes on each request. Returns false on a fatal error;
+ *     a block whose data did not survive clears *allCheck instead.
+ */
+static bool valid_batch(trace_t *trace, range_set_t *ranges, int opnum, int n,
+                        bool *allCheck)
+{
+    const traceop_t *op = &trace->ops[opnum];
+    int k;
+
+    if (op->type == FREE)
+    {
+        for (k = 0; k < n; k++)
+        {
+            if (!check_index(trace, opnum + k, op[k].index))
+                *allCheck = false;
+            if (op[k].index != -1)
+                remove_range(ranges, trace->blocks[op[k].index]);
+        }
+        run_batch(trace, opnum, n);
+        return true;
+    }
+
+    if (!run_batch(trace, opnum, n))
+    {
+        malloc_error(trace, opnum, "mm_malloc_batch failed.");
+        return false;
+    }
+    for (k = 0; k < n; k++)
+    {
+        if (add_range(ranges, trace->blocks[op[k].index], op->size, trace,
+                      opnum + k, op[k].index) == 0)
+            return false;
+        randomize_block(trace, op[k].index);
+    }
+    return true;
+}
+#endif /* !REF_ONLY */
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1583,6 +2018,40 @@ static void eval_libc_speed(void *ptr)
  * Some miscellaneous helper routines
  ************************************/
 
+/*
+ * printheapsizes - prints the largest and the final heap size of the
+ * utilization run of each trace, which differ when the package trims
+ * its heap.
+ */
+static void printheapsizes(int n, stats_t *stats)
+{
+    int i;
+
+    if (tab_mode)
+        printf("peak\tend\ttrace\n");
+    else
+        printf("  %10s %10s %6s  %s\n", "peak KB", "end KB", "end %", "trace");
+    for (i = 0; i < n; i++)
+    {
+        if (!stats[i].valid)
+            continue;
+        if (tab_mode)
+        {
+            printf("%zu\t%zu\t%s\n", stats[i].heap_peak, stats[i].heap_end,
+                   stats[i].filename);
+        }
+        else
+        {
+            printf("  %10.1f %10.1f %5.1f%%  %s\n",
+                   stats[i].heap_peak / 1024.0, stats[i].heap_end / 1024.0,
+                   stats[i].heap_peak
+                       ? 100.0 * stats[i].heap_end / stats[i].heap_peak
+                       : 0.0,
+                   stats[i].filename);
+        }
+    }
+}
+
 /*
  * printresults - prints a performance summary for some malloc package and
  * returns a summary of the stats to the caller.
@@ -2013,7 +2482,8 @@ static double measure_ref_throughput(bool checkpoint)
  */
 static void usage(char *prog)
 {
-    fprintf(stderr, "Usage: %s [-hlVCdD] [-f <file>]\n", prog);
+    fprintf(stderr,
+            "Usage: %s [-hlVCdDHBSMF] [-f <file>] [-a <n>] [-g <n>]\n", prog);
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-C         Calculate Checkpoint Score.\n");
     fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
@@ -2028,4 +2498,17 @@ static void usage(char *prog)
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-T         Print diagnostics in tab mode\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file\n");
+    fprintf(stderr, "\t-H         Print the peak and final heap size of "
+                    "each trace\n");
+    fprintf(stderr, "\t-B         Issue runs of same-size mallocs and runs "
+                    "of frees as batches\n");
+    fprintf(stderr, "\t-S         Free blocks with mm_free_sized\n");
+    fprintf(stderr, "\t-M         Print the allocator's statistics after "
+                    "each trace\n");
+    fprintf(stderr, "\t-F         Print how fragmented the heap is when "
+                    "each trace peaks\n");
+    fprintf(stderr, "\t-a <n>     Allocate blocks with mm_aligned_alloc, "
+                    "aligned to <n> bytes\n");
+    fprintf(stderr, "\t-g <n>[:<max>] Grow the heap by 1/2^<n> of its size "
+                    "at a time, by at most <max> bytes (0: 4 KiB only)\n");
 }
@@ -6,16 +6,36 @@
  * be used as an interpositioning library, and thereby run actual programs.
  */
 #include <assert.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include "config.h"
 #include "memlib.h"
 
+/* Address space reserved for each region other than region 0 */
+#define REGION_LENGTH ((size_t)1 << 32)
+
 /* private global variables */
 static bool init = false;
 static unsigned char *heap;         /* Starting address of heap */
 static unsigned char *mem_brk;      /* Current position of break */
+static unsigned char *region_lo[MEM_REGIONS];  /* Start of regions 1.. */
+static unsigned char *region_brk[MEM_REGIONS]; /* Break of regions 1.. */
+static size_t heap_size;            /* Bytes in use, summed over regions */
+static size_t heap_peak;            /* Largest value heap_size has had */
+static pthread_mutex_t region_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Account for a change of incr bytes in the total heap size */
+static void note_growth(intptr_t incr) {
+    size_t size = __atomic_add_fetch(&heap_size, incr, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+    while (size > peak &&
+           !__atomic_compare_exchange_n(&heap_peak, &peak, size, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
 
 static void ensure_init(void) {
     if (!init) {
@@ -25,7 +45,8 @@ static void ensure_init(void) {
     }
 }
 
-void *mem_sbrk(intptr_t incr) {
+/* Move the break of region 0 by incr bytes, in either direction */
+static void *move_brk(intptr_t incr) {
     ensure_init();
 
     unsigned char *res = sbrk(incr);
@@ -35,9 +56,101 @@ void *mem_sbrk(intptr_t incr) {
 
     assert(res == mem_brk);
     mem_brk += incr;
+    note_growth(incr);
     return (void *) res;
 }
 
+/*
+ * Regions other than region 0 are reserved with mmap the first time they
+ * are extended; the kernel only backs the pages that are touched. Shrinking
+ * such a region hands the whole pages above the new break back to the kernel.
+ */
+static void *move_region(int region, intptr_t incr) {
+    if (region == 0) {
+        return move_brk(incr);
+    }
+
+    pthread_mutex_lock(&region_lock);
+    if (region_lo[region] == NULL) {
+        void *addr = mmap(NULL, REGION_LENGTH, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (addr == MAP_FAILED) {
+            pthread_mutex_unlock(&region_lock);
+            return (void *)-1;
+        }
+        region_brk[region] = addr;
+        __atomic_store_n(&region_lo[region], addr, __ATOMIC_RELEASE);
+    }
+    unsigned char *res = region_brk[region];
+    if ((size_t)(res + incr - region_lo[region]) > REGION_LENGTH) {
+        pthread_mutex_unlock(&region_lock);
+        return (void *)-1;
+    }
+    region_brk[region] += incr;
+    if (incr < 0) {
+        uintptr_t page = (uintptr_t)getpagesize();
+        uintptr_t lo = ((uintptr_t)region_brk[region] + page - 1) & ~(page - 1);
+        if (lo < (uintptr_t)res) {
+            madvise((void *)lo, (uintptr_t)res - lo, MADV_DONTNEED);
+        }
+    }
+    pthread_mutex_unlock(&region_lock);
+    note_growth(incr);
+    return (void *)res;
+}
+
+void *mem_sbrk(intptr_t incr) {
+    if (incr < 0) {
+        return (void *)-1;
+    }
+    return move_brk(incr);
+}
+
+void *mem_region_sbrk(int region, intptr_t incr) {
+    if (incr < 0) {
+        return (void *)-1;
+    }
+    return move_region(region, incr);
+}
+
+void *mem_region_trim(int region, size_t decr) {
+    if (decr > INTPTR_MAX) {
+        return (void *)-1;
+    }
+    return move_region(region, -(intptr_t)decr);
+}
+
+void *mem_region_lo(int region) {
+    return region == 0 ? mem_heap_lo() : (void *)region_lo[region];
+}
+
+void *mem_region_hi(int region) {
+    return region == 0 ? mem_heap_hi() : (void *)(region_brk[region] - 1);
+}
+
+void *mem_region_fresh(int region) {
+    return (char *)mem_region_hi(region) + 1;
+}
+
+/*
+ * The program break may be shared with other code, and a region that shrank
+ * keeps the bytes of its last partial page, so nothing is assumed to be zero.
+ */
+bool mem_zeroed(void) {
+    return false;
+}
+
+int mem_region_of(const void *addr) {
+    const unsigned char *p = addr;
+    for (int k = 1; k < MEM_REGIONS; k++) {
+        unsigned char *lo = __atomic_load_n(&region_lo[k], __ATOMIC_ACQUIRE);
+        if (lo != NULL && p >= lo && p < lo + REGION_LENGTH) {
+            return k;
+        }
+    }
+    return 0;
+}
+
 void *mem_heap_lo(void) {
     ensure_init();
     return (void *)heap;
@@ -53,6 +166,28 @@ size_t mem_heapsize(void) {
     return (size_t)(mem_brk - heap);
 }
 
+void *mem_map(size_t len) {
+    void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        return (void *)-1;
+    }
+    note_growth(len);
+    return addr;
+}
+
+int mem_unmap(void *addr, size_t len) {
+    if (munmap(addr, len) != 0) {
+        return -1;
+    }
+    note_growth(-(intptr_t)len);
+    return 0;
+}
+
+size_t mem_heap_peak(void) {
+    return __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+}
+
 size_t mem_pagesize(void) {
     return (size_t)getpagesize();
 }
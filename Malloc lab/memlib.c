@@ -24,8 +24,28 @@
  * Loading from the sparse emulation uses the above lookup and then aggregates
  *  the data into a return value.
  *
+ * The heap can be split into MEM_REGIONS disjoint regions, each with its own
+ *  break, so that a malloc package can keep several independent heaps.
+ *  Region 0 starts at the bottom of the heap area and is the one grown by
+ *  mem_sbrk.  Region k > 0 is a fixed slice of REGION_FRACTION of the heap
+ *  area, the k-th slice counting down from the top.  Region 0 may grow up to
+ *  the lowest slice that has been used.
+ *
+ * mem_region_trim shrinks a region again, down to its start.  The
+ *  released bytes become unaddressable, and mem_heap_peak keeps reporting
+ *  the largest heap the package ever held.
+ *
+ * Blocks of memory can also be mapped and unmapped individually, the way
+ *  mmap works next to brk.  Mappings are placed from the bottom of the
+ *  lowest region slice downwards, and region 0 may not grow into them.
+ *  Their bytes count towards the heap size.
+ *
+ * The heap area starts out as zero-filled pages.  Bytes above the highest
+ *  break a region has had since mem_init, and newly mapped blocks, still read
+ *  as zero in dense mode, which lets calloc skip clearing them.
+ *
  * If an emulated access is made to an address outside of the current
- *  bounds (mem_heap_lo, mem_heap_hi), then the address is assumed to be to
+ *  bounds of every region, then the address is assumed to be to
  *  a non-heap location, such as stack, global variables, etc.  For some
  *  implementations, this access is meant to be to the heap and was "safe"
  *  in non-emulation, as it was to the same page as actual heap data.  But
@@ -35,6 +55,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -63,11 +84,28 @@ typedef struct MBLK
     unsigned char bytes[SPARSE_PAGE_SIZE]; /* Page contents */
 } mem_block_t;
 
+/* Regions 1 .. MEM_REGIONS-1 each get 1/REGION_FRACTION of the heap area */
+#define REGION_FRACTION 16
+
+/* Maximum number of blocks mapped by mem_map at once */
+#define MAX_MAPS (1 << 16)
+
 /* private global variables */
 static bool sparse = false;         /* Use sparse memory emulation */
 static unsigned char *heap;         /* Starting address of heap */
-static unsigned char *mem_brk;      /* Current position of break */
 static unsigned char *mem_max_addr; /* Maximum allowable heap address */
+static size_t region_length;        /* Size of regions 1 .. MEM_REGIONS-1 */
+static unsigned char *region_lo[MEM_REGIONS];  /* Start of each region */
+static unsigned char *region_brk[MEM_REGIONS]; /* Break of each region */
+static unsigned char *region_hwm[MEM_REGIONS]; /* Highest break since init */
+static int regions_used = 1; /* One more than the highest region used */
+static size_t heap_peak;     /* Largest total size of the heap so far */
+static unsigned char *map_lo[MAX_MAPS]; /* Mappings, highest address first */
+static size_t map_len[MAX_MAPS];        /* Length of each mapping */
+static int num_maps;                    /* Number of mappings */
+static size_t map_bytes;                /* Total length of the mappings */
+static pthread_mutex_t region_lock = /* Serializes mem_region_sbrk */
+    PTHREAD_MUTEX_INITIALIZER;
 static size_t mmap_length =
     MAX_DENSE_HEAP; /* Number of bytes allocated by mmap */
 static bool show_stats =
@@ -113,6 +151,10 @@ const char *__msan_default_options()
 static size_t page_id(const void *addr);
 static void *page_start(size_t id);
 static void *get_mem(const void *addr, size_t, bool);
+static void mem_reset_regions();
+static bool in_heap(const void *addr, size_t len);
+static int map_index(const void *addr);
+static void note_heapsize();
 static void print_stats();
 
 /*
@@ -171,8 +213,14 @@ void mem_init(bool do_sparse)
         heap = addr;
         mem_max_addr = heap + MAX_DENSE_HEAP;
     }
+    region_length = (size_t)(mem_max_addr - heap) / REGION_FRACTION;
+    region_lo[0] = heap;
+    for (int k = 1; k < MEM_REGIONS; k++)
+        region_lo[k] = mem_max_addr - k * region_length;
+    for (int k = 0; k < MEM_REGIONS; k++)
+        region_hwm[k] = region_lo[k];
     stats_printed = false;
-    mem_brk = heap;
+    mem_reset_regions();
 }
 
 /*
@@ -216,36 +264,82 @@ void mem_reset_brk()
         /* Mark heap as uninitialized (though payloads may be overwritten by driver!) */
         __msan_allocated_memory(heap, MAX_DENSE_HEAP);
 #endif
+        /* Mappings read as zero when they are handed out again */
+        for (int i = 0; i < num_maps; i++)
+            madvise(map_lo[i], map_len[i], MADV_DONTNEED);
     }
-    mem_brk = heap;
+    mem_reset_regions();
+}
+
+/*
+ * mem_reset_regions - empty every region
+ */
+static void mem_reset_regions()
+{
+    for (int k = 0; k < MEM_REGIONS; k++)
+        region_brk[k] = region_lo[k];
+    regions_used = 1;
+    heap_peak = 0;
+    num_maps = 0;
+    map_bytes = 0;
 }
 
 /*
  * mem_sbrk - simple model of the sbrk function. Extends the heap
  *                by incr bytes and returns the start address of the new area.
- * In this model, the heap cannot be shrunk.
+ * In this model, the heap can only be shrunk with mem_region_trim.
  */
 void *mem_sbrk(intptr_t incr)
 {
-    unsigned char *old_brk = mem_brk;
+    return mem_region_sbrk(0, incr);
+}
+
+/*
+ * mem_region_sbrk - extend region by incr bytes and return the start address
+ *     of the new area.  A region other than 0 can only be used while region 0
+ *     lies entirely below it.
+ */
+void *mem_region_sbrk(int region, intptr_t incr)
+{
+    assert(0 <= region && region < MEM_REGIONS);
+    pthread_mutex_lock(&region_lock);
+    unsigned char *old_brk = region_brk[region];
+    unsigned char *limit;
+
+    if (region == 0)
+    {
+        limit = regions_used > 1 ? region_lo[regions_used - 1] : mem_max_addr;
+        if (num_maps > 0 && map_lo[num_maps - 1] < limit)
+            limit = map_lo[num_maps - 1];
+    }
+    else
+        limit = region_lo[region] + region_length;
 
     bool ok = true;
     if (incr < 0)
     {
         ok = false;
         fprintf(stderr,
-                "ERROR: mem_sbrk failed.  Attempt to expand heap by negative "
-                "value %ld\n",
-                (long)incr);
+                "ERROR: mem_sbrk failed.  Attempt to expand region %d by "
+                "negative value %ld\n",
+                region, (long)incr);
+    }
+    else if (region >= regions_used && region_brk[0] > region_lo[region])
+    {
+        ok = false;
+        fprintf(stderr,
+                "ERROR: mem_sbrk failed.  Region 0 already extends into "
+                "region %d\n",
+                region);
     }
-    else if (mem_brk + incr > mem_max_addr)
+    else if (incr > limit - old_brk)
     {
         ok = false;
-        size_t alloc = mem_brk - heap + incr;
+        size_t alloc = (size_t)(old_brk - region_lo[region]) + (size_t)incr;
         fprintf(stderr,
                 "ERROR: mem_sbrk failed. Ran out of memory.  Would require "
-                "heap size of %zd (0x%zx) bytes\n",
-                alloc, alloc);
+                "region %d size of %zu (0x%zx) bytes\n",
+                region, alloc, alloc);
     }
     else if (!sparse && sbrk(incr) == (void *)-1)
     {
@@ -259,18 +353,144 @@ void *mem_sbrk(intptr_t incr)
     {
 #ifdef USE_ASAN
         /* Mark the extended section of the heap as addressable */
-        __asan_unpoison_memory_region(mem_brk, incr);
+        __asan_unpoison_memory_region(old_brk, incr);
 #endif
-        mem_brk += incr;
+        region_brk[region] += incr;
+        if (region_brk[region] > region_hwm[region])
+            region_hwm[region] = region_brk[region];
+        if (region >= regions_used)
+            __atomic_store_n(&regions_used, region + 1, __ATOMIC_RELEASE);
+        if (incr > 0)
+            note_heapsize();
+        pthread_mutex_unlock(&region_lock);
         return (void *)old_brk;
     }
     else
     {
+        pthread_mutex_unlock(&region_lock);
         errno = ENOMEM;
         return (void *)-1;
     }
 }
 
+/*
+ * mem_region_trim - shrink region by decr bytes and return its old break.
+ *     The released bytes may no longer be accessed.
+ */
+void *mem_region_trim(int region, size_t decr)
+{
+    assert(0 <= region && region < MEM_REGIONS);
+    pthread_mutex_lock(&region_lock);
+    unsigned char *old_brk = region_brk[region];
+
+    if ((size_t)(old_brk - region_lo[region]) < decr)
+    {
+        pthread_mutex_unlock(&region_lock);
+        fprintf(stderr,
+                "ERROR: mem_region_trim failed.  Attempt to shrink region %d "
+                "by %zu bytes, more than its size\n",
+                region, decr);
+        errno = EINVAL;
+        return (void *)-1;
+    }
+
+#ifdef USE_ASAN
+    /* Mark the released section of the heap as unaddressable */
+    __asan_poison_memory_region(old_brk - decr, decr);
+#endif
+    region_brk[region] -= decr;
+    pthread_mutex_unlock(&region_lock);
+    return (void *)old_brk;
+}
+
+/*
+ * mem_map - map a new block of at least len bytes, rounded up to whole pages,
+ *     and return its page-aligned start address
+ */
+void *mem_map(size_t len)
+{
+    size_t page = mem_pagesize();
+    if (len == 0 || len > (size_t)(mem_max_addr - heap))
+    {
+        errno = ENOMEM;
+        return (void *)-1;
+    }
+    len = (len + page - 1) & ~(page - 1);
+
+    pthread_mutex_lock(&region_lock);
+    /* First fit, walking down the gaps between mappings */
+    unsigned char *gap_hi = mem_max_addr - (MEM_REGIONS - 1) * region_length;
+    unsigned char *addr = NULL;
+    int i;
+    for (i = 0; i <= num_maps; i++)
+    {
+        unsigned char *gap_lo = i < num_maps ? map_lo[i] + map_len[i]
+                                             : region_brk[0];
+        if (gap_hi >= gap_lo && (size_t)(gap_hi - gap_lo) >= len)
+        {
+            addr = gap_hi - len;
+            break;
+        }
+        if (i < num_maps)
+            gap_hi = map_lo[i];
+    }
+    if (addr == NULL || num_maps == MAX_MAPS)
+    {
+        pthread_mutex_unlock(&region_lock);
+        errno = ENOMEM;
+        return (void *)-1;
+    }
+    memmove(&map_lo[i + 1], &map_lo[i], (num_maps - i) * sizeof(map_lo[0]));
+    memmove(&map_len[i + 1], &map_len[i], (num_maps - i) * sizeof(map_len[0]));
+    map_lo[i] = addr;
+    map_len[i] = len;
+    num_maps++;
+    map_bytes += len;
+    note_heapsize();
+    pthread_mutex_unlock(&region_lock);
+#ifdef USE_ASAN
+    __asan_unpoison_memory_region(addr, len);
+#endif
+    return (void *)addr;
+}
+
+/*
+ * mem_unmap - remove the mapping that starts at addr.  len must be the
+ *     length passed to mem_map.  Returns 0, or -1 if there is no such mapping.
+ */
+int mem_unmap(void *addr, size_t len)
+{
+    size_t page = mem_pagesize();
+    len = (len + page - 1) & ~(page - 1);
+
+    pthread_mutex_lock(&region_lock);
+    int i = map_index(addr);
+    if (i == num_maps || map_lo[i] != addr || map_len[i] != len)
+    {
+        pthread_mutex_unlock(&region_lock);
+        fprintf(stderr, "ERROR: mem_unmap failed.  No mapping of %zd bytes "
+                        "at %p\n",
+                len, addr);
+        errno = EINVAL;
+        return -1;
+    }
+    num_maps--;
+    memmove(&map_lo[i], &map_lo[i + 1], (num_maps - i) * sizeof(map_lo[0]));
+    memmove(&map_len[i], &map_len[i + 1], (num_maps - i) * sizeof(map_len[0]));
+    map_bytes -= len;
+    if (!sparse)
+    {
+#ifdef USE_ASAN
+        __asan_poison_memory_region(addr, len);
+#endif
+        /* Hand the pages back before they can be mapped again; they read as
+         * zero once touched again */
+        madvise(addr, len, MADV_DONTNEED);
+    }
+    pthread_mutex_unlock(&region_lock);
+    return 0;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -284,15 +504,86 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    int k;
+    /* Regions above region 0 are numbered from the top down */
+    for (k = 1; k < regions_used; k++)
+        if (region_brk[k] > region_lo[k])
+            return (void *)(region_brk[k] - 1);
+    /* Mappings lie between the region slices and region 0 */
+    if (num_maps > 0)
+        return (void *)(map_lo[0] + map_len[0] - 1);
+    return (void *)(region_brk[0] - 1);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the heap size in bytes, summed over all regions
+ *     and mappings
  */
 size_t mem_heapsize()
 {
-    return (size_t)(mem_brk - heap);
+    size_t size = map_bytes;
+    for (int k = 0; k < regions_used; k++)
+        size += (size_t)(region_brk[k] - region_lo[k]);
+    return size;
+}
+
+/*
+ * mem_heap_peak() - returns the largest heap size in bytes, summed over all
+ *     regions and mappings, since the heap was last reset
+ */
+size_t mem_heap_peak()
+{
+    return heap_peak;
+}
+
+/*
+ * mem_region_lo - return address of the first byte of a region
+ */
+void *mem_region_lo(int region)
+{
+    return (void *)region_lo[region];
+}
+
+/*
+ * mem_region_hi - return address of the last byte in use in a region
+ */
+void *mem_region_hi(int region)
+{
+    return (void *)(region_brk[region] - 1);
+}
+
+/*
+ * mem_region_fresh - return the highest break a region has had since
+ *     mem_init.  Memory above it has never been handed out.
+ */
+void *mem_region_fresh(int region)
+{
+    return (void *)region_hwm[region];
+}
+
+/*
+ * mem_zeroed - can memory that has never been handed out be relied on to
+ *     read as zero?  Not in sparse mode, where pages are recycled and bytes
+ *     that were never written may not be read at all.
+ */
+bool mem_zeroed()
+{
+    return !sparse;
+}
+
+/*
+ * mem_region_of - return the region whose slice of the heap area contains
+ *     addr, or -1 if addr lies outside the heap area
+ */
+int mem_region_of(const void *addr)
+{
+    const unsigned char *p = addr;
+    int used = __atomic_load_n(&regions_used, __ATOMIC_ACQUIRE);
+    if (p < heap || p >= mem_max_addr)
+        return -1;
+    if (used > 1 && p >= region_lo[used - 1])
+        return (int)((size_t)(mem_max_addr - 1 - p) / region_length) + 1;
+    return 0;
 }
 
 /*
@@ -323,8 +614,7 @@ void mem_write128(void *addr, __int128 val)
 uint64_t mem_read(const void *addr, size_t len)
 {
     uint64_t rdata;
-    if (sparse && (unsigned char *)addr >= heap &&
-        (unsigned char *)addr + len <= mem_brk)
+    if (sparse && in_heap(addr, len))
     {
         /* Heap read.  Check if it crosses page boundary */
         size_t id = page_id(addr);
@@ -367,8 +657,7 @@ uint64_t mem_read(const void *addr, size_t len)
 /* Write lower order len bytes of val to address */
 void mem_write(void *addr, uint64_t val, size_t len)
 {
-    if (sparse && (unsigned char *)addr >= heap &&
-        (unsigned char *)addr + len <= mem_brk)
+    if (sparse && in_heap(addr, len))
     {
         /* Heap write.  Check to see if it crosses page boundary */
         size_t id = page_id(addr);
@@ -487,6 +776,42 @@ void hprobe(void *ptr, int offset, size_t count)
 
 /*************** Private Functions *******************/
 
+/* Does [addr, addr + len) lie within the used part of some region, or
+ * within a mapping? */
+static bool in_heap(const void *addr, size_t len)
+{
+    const unsigned char *p = addr;
+    for (int k = 0; k < regions_used; k++)
+        if (p >= region_lo[k] && p + len <= region_brk[k])
+            return true;
+    int i = map_index(p);
+    return i < num_maps && p + len <= map_lo[i] + map_len[i];
+}
+
+/* Index of the highest mapping that starts at or below addr, or num_maps if
+ * there is none */
+static int map_index(const void *addr)
+{
+    int lo = 0, hi = num_maps;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (map_lo[mid] > (const unsigned char *)addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Raise the peak heap size to the current one; region_lock must be held */
+static void note_heapsize()
+{
+    size_t size = mem_heapsize();
+    if (size > heap_peak)
+        heap_peak = size;
+}
+
 static void print_stats()
 {
     size_t vbytes = mem_heapsize();
@@ -499,12 +824,12 @@ static void print_stats()
         printf("Allocated %zu/%zu pages (%zu bytes) to cover %zu heap bytes "
                "(%.4f%% density).  Max address = %p\n",
                ppages, num_pages, pbytes, vbytes, 100.0 * pbytes / vbytes,
-               mem_brk);
+               (unsigned char *)mem_heap_hi() + 1);
     }
     else
     {
         printf("Allocated %zu heap bytes.  Max address = %p\n", vbytes,
-               mem_brk);
+               (unsigned char *)mem_heap_hi() + 1);
     }
     stats_printed = true;
 }
@@ -10,6 +10,12 @@
 #include <stdint.h>
 #include <unistd.h>
 
+/**
+ * @brief Number of disjoint regions the heap can be split into, each of
+ * which grows independently (see mem_region_sbrk).
+ */
+#define MEM_REGIONS 8
+
 /**
  * @brief
  * @param[in] sparse
@@ -24,16 +30,104 @@ void mem_deinit(void);
 /**
  * @brief Extends the heap by incr bytes.
  *
- * This function is a simple model of the sbrk() function, except for that
- * with this implementation, the heap cannot be shrunk.
+ * This function is a simple model of the sbrk() function. The heap can
+ * only be shrunk with mem_region_trim.
  *
  * @param[in] incr The amount of bytes by which to extend the heap
  * @return The start address of the new heap area (i.e. the previous
- *         breakpoint)
- * @pre `incr > 0`
+ *         breakpoint), or (void *)-1 if incr is negative or the heap cannot
+ *         grow
  */
 void *mem_sbrk(intptr_t incr);
 
+/**
+ * @brief Extends one region of the heap by incr bytes.
+ *
+ * Region 0 is the region grown by mem_sbrk. The other regions lie above it,
+ * each with a fixed maximum size of 1/16 of the heap area. Their memory
+ * never overlaps, and several threads may extend different regions at once.
+ *
+ * @param[in] region The region to extend, `0 <= region < MEM_REGIONS`
+ * @param[in] incr The amount of bytes by which to extend the region
+ * @return The start address of the new area (i.e. the previous break of the
+ *         region), or (void *)-1 if incr is negative or the region cannot
+ *         grow
+ */
+void *mem_region_sbrk(int region, intptr_t incr);
+
+/**
+ * @brief Shrinks one region of the heap by decr bytes.
+ *
+ * The bytes released at the end of the region may no longer be accessed.
+ *
+ * @param[in] region The region to shrink, `0 <= region < MEM_REGIONS`
+ * @param[in] decr The amount of bytes by which to shrink the region
+ * @return The previous break of the region, or (void *)-1 if the region is
+ *         smaller than decr bytes
+ */
+void *mem_region_trim(int region, size_t decr);
+
+/**
+ * @brief Finds the low address of a region.
+ * @param[in] region The region
+ * @return The address of the first byte of the region.
+ */
+void *mem_region_lo(int region);
+
+/**
+ * @brief Finds the high address of a region.
+ * @param[in] region The region
+ * @return The address of the last byte in use in the region.
+ */
+void *mem_region_hi(int region);
+
+/**
+ * @brief Finds where the never-used part of a region starts.
+ *
+ * Extending a region past this address gives memory that no earlier heap
+ * has touched since mem_init. If mem_zeroed() is true, it reads as zero.
+ *
+ * @param[in] region The region
+ * @return The highest break the region has had since mem_init
+ */
+void *mem_region_fresh(int region);
+
+/**
+ * @brief Tells whether fresh memory reads as zero.
+ * @return true if memory above mem_region_fresh() and blocks from mem_map
+ *         are zero-filled when they are handed out
+ */
+bool mem_zeroed(void);
+
+/**
+ * @brief Finds the region an address belongs to.
+ * @param[in] addr An address returned from some region
+ * @return The region, or -1 if addr is outside the heap area
+ */
+int mem_region_of(const void *addr);
+
+/**
+ * @brief Maps a block of memory that can be released on its own.
+ *
+ * This is a simple model of an anonymous mmap(). The block lies outside
+ * every region, and its length counts towards the heap size until it is
+ * unmapped. Several threads may map and unmap blocks at once.
+ *
+ * @param[in] len The number of bytes needed, which is rounded up to a
+ *                multiple of the page size
+ * @return The page-aligned start address of the block, or (void *)-1 with
+ *         errno set to ENOMEM if there is no room for it
+ */
+void *mem_map(size_t len);
+
+/**
+ * @brief Releases a block returned by mem_map.
+ * @param[in] addr The start address of the block
+ * @param[in] len The length that was passed to mem_map
+ * @return 0 on success, or -1 if no such block is mapped
+ */
+int mem_unmap(void *addr, size_t len);
+
 /**
  * @brief Resets the simulated brk pointer to make an empty heap.
  */
@@ -48,6 +142,8 @@ void *mem_heap_lo(void);
 /**
  * @brief Finds the high address of the heap.
  *
+ * When several regions are in use, this is the end of the highest one.
+ *
  * Note that this address may not be aligned: if the heap is 8 bytes large,
  * then the value returned will be 7 bytes from the start of the heap.
  *
@@ -57,10 +153,22 @@ void *mem_heap_hi(void);
 
 /**
  * @brief Returns the number of bytes being used by the heap.
- * @return The size of the heap, in bytes
+ * @return The size of the heap summed over all regions and mapped blocks,
+ *         in bytes
  */
 size_t mem_heapsize(void);
 
+/**
+ * @brief Returns the largest size the heap has reached.
+ *
+ * This differs from mem_heapsize() once memory has been returned with
+ * mem_region_trim or mem_unmap.
+ *
+ * @return The peak heap size summed over all regions and mapped blocks
+ *         since the last mem_reset_brk, in bytes
+ */
+size_t mem_heap_peak(void);
+
 /**
  * @brief Returns the system page size.
  * @return The page size of the system, in bytes
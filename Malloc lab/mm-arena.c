@@ -0,0 +1,143 @@
+/*
+ * mm-arena.c - Bump-pointer regions on top of mm_malloc (see mm-arena.h)
+ *
+ * A region is one mm_malloc block that holds the region's bookkeeping and
+ * its first block of objects. When that fills up, the region gets another
+ * block of the same size from mm_malloc and goes on bumping there; the
+ * room left at the end of the old block is not used again until the next
+ * reset. An object of more than a quarter of a block gets a block of its
+ * own, so that it neither wastes the rest of the current block nor makes
+ * the region give up on it.
+ *
+ * Every block but the first is on a list, which reset and destroy walk to
+ * hand the blocks back to mm_free: one call per block instead of one per
+ * object.
+ */
+#include <stdint.h>
+
+#include "mm-arena.h"
+#include "mm.h"
+
+/* Alignment of every object, the same as that of mm_malloc */
+#define ALIGN 16
+
+/* Block size used when mm_arena_create is passed 0 */
+#define DEFAULT_BLOCK_SIZE (64 << 10)
+
+/* Smallest block size, so that the first block holds a few objects */
+#define MIN_BLOCK_SIZE 1024
+
+/* A block got from mm_malloc after the first */
+struct arena_block
+{
+    struct arena_block *next; /* the block got before it, or NULL */
+    size_t size;              /* bytes of objects it holds */
+};
+
+struct mm_arena
+{
+    char *bump;                 /* next free byte of the current block */
+    char *end;                  /* end of the current block */
+    struct arena_block *blocks; /* blocks after the first, newest first */
+    size_t block_size;          /* bytes of objects per block */
+};
+
+/* Room taken by the headers above, which keeps objects aligned */
+static const size_t arena_header =
+    (sizeof(struct mm_arena) + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+static const size_t block_header =
+    (sizeof(struct arena_block) + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+
+/*
+ * first_block - Return the start of the objects in the block that the
+ *     region itself lives in.
+ */
+static char *first_block(struct mm_arena *arena)
+{
+    return (char *)arena + arena_header;
+}
+
+/*
+ * new_block - Get a block for at least size bytes of objects from
+ *     mm_malloc and put it on the region's list. Returns the start of its
+ *     objects, or NULL.
+ */
+static char *new_block(struct mm_arena *arena, size_t size)
+{
+    if (size > SIZE_MAX - block_header)
+        return NULL;
+    struct arena_block *block = mm_malloc(block_header + size);
+    if (block == NULL)
+        return NULL;
+    block->next = arena->blocks;
+    block->size = size;
+    arena->blocks = block;
+    return (char *)block + block_header;
+}
+
+struct mm_arena *mm_arena_create(size_t block_size)
+{
+    if (block_size == 0)
+        block_size = DEFAULT_BLOCK_SIZE;
+    if (block_size < MIN_BLOCK_SIZE)
+        block_size = MIN_BLOCK_SIZE;
+    if (block_size > SIZE_MAX / 2 - arena_header)
+        return NULL;
+    block_size = (block_size + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+
+    struct mm_arena *arena = mm_malloc(arena_header + block_size);
+    if (arena == NULL)
+        return NULL;
+    arena->block_size = block_size;
+    arena->blocks = NULL;
+    arena->bump = first_block(arena);
+    arena->end = arena->bump + block_size;
+    return arena;
+}
+
+void *mm_arena_alloc(struct mm_arena *arena, size_t size)
+{
+    if (size == 0 || size > SIZE_MAX - ALIGN)
+        return NULL;
+    size = (size + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+
+    /* The common case: the object fits in the current block */
+    char *p = arena->bump;
+    if (size <= (size_t)(arena->end - p))
+    {
+        arena->bump = p + size;
+        return p;
+    }
+
+    /* A large object gets a block of its own; bumping goes on where it was */
+    if (size > arena->block_size / 4)
+        return new_block(arena, size);
+
+    if ((p = new_block(arena, arena->block_size)) == NULL)
+        return NULL;
+    arena->bump = p + size;
+    arena->end = p + arena->block_size;
+    return p;
+}
+
+void mm_arena_reset(struct mm_arena *arena)
+{
+    struct arena_block *block = arena->blocks;
+    while (block != NULL)
+    {
+        struct arena_block *next = block->next;
+        mm_free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+    arena->bump = first_block(arena);
+    arena->end = arena->bump + arena->block_size;
+}
+
+void mm_arena_destroy(struct mm_arena *arena)
+{
+    if (arena == NULL)
+        return;
+    mm_arena_reset(arena);
+    mm_free(arena);
+}
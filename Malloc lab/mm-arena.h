@@ -0,0 +1,55 @@
+/**
+ * @file mm-arena.h
+ * @brief Bump-pointer regions built on top of mm_malloc
+ *
+ * A region hands out objects from large blocks that it gets from mm_malloc,
+ * by moving a pointer forward, and gives them all back at once when it is
+ * reset or destroyed. Objects cannot be freed one by one. This suits code
+ * that makes many short-lived objects which all die together, such as the
+ * objects of one request.
+ *
+ * These regions have nothing to do with the arenas inside mm.c, which
+ * split the heap between threads; they are ordinary mm_malloc clients.
+ */
+
+#ifndef MM_ARENA_H
+#define MM_ARENA_H
+
+#include <stddef.h>
+
+/** @brief A region; its layout is private to mm-arena.c */
+struct mm_arena;
+
+/**
+ * @brief Creates an empty region.
+ * @param[in] block_size The size of the blocks to get from mm_malloc, or 0
+ * for the default of 64 KiB; objects of more than a quarter of it get a
+ * block of their own
+ * @return The region, or NULL if mm_malloc fails
+ */
+struct mm_arena *mm_arena_create(size_t block_size);
+
+/**
+ * @brief Allocates an object in a region.
+ * @param[in] arena The region
+ * @param[in] size The size of the object
+ * @return A 16-byte aligned pointer to the object, or NULL if size is 0 or
+ * mm_malloc fails
+ */
+void *mm_arena_alloc(struct mm_arena *arena, size_t size);
+
+/**
+ * @brief Frees every object of a region at once. The first block of the
+ * region is kept for the objects allocated next; the others go back to
+ * mm_free.
+ * @param[in] arena The region
+ */
+void mm_arena_reset(struct mm_arena *arena);
+
+/**
+ * @brief Frees every object of a region and the region itself.
+ * @param[in] arena The region, or NULL
+ */
+void mm_arena_destroy(struct mm_arena *arena);
+
+#endif /* MM_ARENA_H */
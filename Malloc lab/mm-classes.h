@@ -0,0 +1,24 @@
+/*
+ * mm-classes.h - Size-class options for mm.c
+ *
+ * Generated by mmtune from 26 traces. Do not edit; run mmtune again, or
+ * delete this file to build mm.c with its own defaults.
+ *
+ * Average utilization 74.9%, throughput 21625 Kops/s, score 1.881
+ */
+#ifndef MM_CLASSES_H
+#define MM_CLASSES_H
+
+#ifndef MM_CLASS_SUB_BITS
+#define MM_CLASS_SUB_BITS 3
+#endif
+
+#ifndef MM_FIT_PROBES
+#define MM_FIT_PROBES 2
+#endif
+
+#ifndef MM_TREE_MIN_SHIFT
+#define MM_TREE_MIN_SHIFT 14
+#endif
+
+#endif /* MM_CLASSES_H */
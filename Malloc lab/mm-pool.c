@@ -0,0 +1,131 @@
+/*
+ * mm-pool.c - Pools of fixed-size objects on top of mm_malloc (see mm-pool.h)
+ *
+ * A pool carves its objects out of slabs that it gets from mm_malloc, each
+ * with room for at least SLAB_OBJECTS objects and SLAB_MIN_SIZE bytes. The
+ * objects of the newest slab are handed out in address order the first
+ * time, by bumping a pointer, so that a fresh slab is not walked to build a
+ * free list. A freed object goes on a LIFO list through its first word and
+ * is handed out again before any new one; the most recently freed object is
+ * the one most likely to still be in the cache.
+ *
+ * The slabs are on a list of their own, which mm_pool_destroy walks. Slabs
+ * are never given back before that: a slab can only be freed once all of
+ * its objects are, which the pool would have to count per slab.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mm-pool.h"
+#include "mm.h"
+
+/* Alignment of every object, the same as that of mm_malloc */
+#define ALIGN 16
+
+/* Fewest objects per slab */
+#define SLAB_OBJECTS 32
+
+/* Smallest slab, in bytes of objects */
+#define SLAB_MIN_SIZE 4096
+
+/* A free object, linked through its first word */
+struct pool_free
+{
+    struct pool_free *next;
+};
+
+/* The start of a slab got from mm_malloc */
+struct pool_slab
+{
+    struct pool_slab *next; /* the slab got before it, or NULL */
+};
+
+struct mm_pool
+{
+    struct pool_free *free;  /* objects freed and not handed out again */
+    char *bump;              /* next object never handed out */
+    char *end;               /* end of the objects of the newest slab */
+    struct pool_slab *slabs; /* slabs, newest first */
+    size_t obj_size;         /* size of every object */
+    size_t slab_size;        /* bytes of objects per slab */
+};
+
+/* Room taken by a slab header, which keeps objects aligned */
+static const size_t slab_header =
+    (sizeof(struct pool_slab) + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+
+/*
+ * new_slab - Get a slab from mm_malloc and start handing out its objects.
+ *     Returns false if mm_malloc fails.
+ */
+static bool new_slab(struct mm_pool *pool)
+{
+    struct pool_slab *slab = mm_malloc(slab_header + pool->slab_size);
+    if (slab == NULL)
+        return false;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->bump = (char *)slab + slab_header;
+    pool->end = pool->bump + pool->slab_size;
+    return true;
+}
+
+struct mm_pool *mm_pool_create(size_t obj_size)
+{
+    if (obj_size == 0 ||
+        obj_size > (SIZE_MAX / 2 - slab_header) / SLAB_OBJECTS)
+        return NULL;
+    obj_size = (obj_size + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+
+    struct mm_pool *pool = mm_malloc(sizeof(struct mm_pool));
+    if (pool == NULL)
+        return NULL;
+    pool->free = NULL;
+    pool->bump = NULL;
+    pool->end = NULL;
+    pool->slabs = NULL;
+    pool->obj_size = obj_size;
+    /* A whole number of objects, at least SLAB_MIN_SIZE bytes */
+    size_t count = SLAB_MIN_SIZE / obj_size;
+    pool->slab_size = obj_size * (count > SLAB_OBJECTS ? count : SLAB_OBJECTS);
+    return pool;
+}
+
+void *mm_pool_alloc(struct mm_pool *pool)
+{
+    struct pool_free *obj = pool->free;
+    if (obj != NULL)
+    {
+        pool->free = obj->next;
+        return obj;
+    }
+
+    if (pool->bump == pool->end && !new_slab(pool))
+        return NULL;
+    char *p = pool->bump;
+    pool->bump = p + pool->obj_size;
+    return p;
+}
+
+void mm_pool_free(struct mm_pool *pool, void *obj)
+{
+    if (obj == NULL)
+        return;
+    struct pool_free *f = obj;
+    f->next = pool->free;
+    pool->free = f;
+}
+
+void mm_pool_destroy(struct mm_pool *pool)
+{
+    if (pool == NULL)
+        return;
+    struct pool_slab *slab = pool->slabs;
+    while (slab != NULL)
+    {
+        struct pool_slab *next = slab->next;
+        mm_free(slab);
+        slab = next;
+    }
+    mm_free(pool);
+}
@@ -0,0 +1,49 @@
+/**
+ * @file mm-pool.h
+ * @brief Pools of fixed-size objects built on top of mm_malloc
+ *
+ * A pool hands out objects of one size. It gets slabs of many objects at a
+ * time from mm_malloc and keeps the objects freed back to it on a list that
+ * runs through the objects themselves, so that allocating and freeing an
+ * object takes a few instructions and objects carry no header. Slabs go
+ * back to mm_free only when the pool is destroyed.
+ */
+
+#ifndef MM_POOL_H
+#define MM_POOL_H
+
+#include <stddef.h>
+
+/** @brief A pool; its layout is private to mm-pool.c */
+struct mm_pool;
+
+/**
+ * @brief Creates an empty pool.
+ * @param[in] obj_size The size of every object, rounded up to a multiple of
+ * 16 bytes
+ * @return The pool, or NULL if obj_size is 0 or mm_malloc fails
+ */
+struct mm_pool *mm_pool_create(size_t obj_size);
+
+/**
+ * @brief Allocates an object from a pool.
+ * @param[in] pool The pool
+ * @return A 16-byte aligned pointer to the object, or NULL if mm_malloc
+ * fails
+ */
+void *mm_pool_alloc(struct mm_pool *pool);
+
+/**
+ * @brief Gives an object back to the pool it came from.
+ * @param[in] pool The pool
+ * @param[in] obj An object allocated from the pool, or NULL
+ */
+void mm_pool_free(struct mm_pool *pool, void *obj);
+
+/**
+ * @brief Frees every object of a pool, and the pool itself.
+ * @param[in] pool The pool, or NULL
+ */
+void mm_pool_destroy(struct mm_pool *pool);
+
+#endif /* MM_POOL_H */
@@ -0,0 +1,121 @@
+/**
+ * @file mm-stats.h
+ * @brief Allocator statistics reported by mm_stats and mm_fragmentation
+ *
+ * mm.c keeps the counters of mm_stats when it is built with MM_STATS (the
+ * default). mm_fragmentation needs no counters; it walks the heap. More
+ * detail on what each one reports is in mm.c.
+ */
+
+#ifndef MM_STATS_H
+#define MM_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** @brief Number of size classes, one per segregated free list of mm.c */
+#define MM_STATS_CLASSES 128
+
+/**
+ * @brief Number of buckets in the histogram of free-list search lengths.
+ * Bucket 0 counts searches that looked at no block, bucket k > 0 those that
+ * looked at 2^(k-1) to 2^k - 1 blocks, and the last bucket everything longer.
+ */
+#define MM_STATS_PROBE_BUCKETS 10
+
+/**
+ * @brief A snapshot of the allocator's counters since the last mm_init.
+ *
+ * Blocks are sorted into classes by their size, header included, the same
+ * way mm.c sorts free blocks into its lists; class_size gives the smallest
+ * block size of each class. Payload bytes are the usable size of the blocks
+ * handed out, which may be a little more than was asked for.
+ */
+struct mm_stats {
+    /** @brief Whether the counters are kept; all are zero if not */
+    bool enabled;
+    /** @brief Smallest block size of each class */
+    size_t class_size[MM_STATS_CLASSES];
+    /** @brief Blocks allocated, per class */
+    size_t allocs[MM_STATS_CLASSES];
+    /** @brief Blocks freed, per class */
+    size_t frees[MM_STATS_CLASSES];
+    /** @brief Blocks now on each segregated free list */
+    size_t list_length[MM_STATS_CLASSES];
+    /** @brief Blocks now on the list of free mini-blocks */
+    size_t mini_length;
+    /** @brief Blocks now in the size tree of large free blocks */
+    size_t tree_length;
+    /** @brief Histogram of the number of blocks each free-list search saw */
+    size_t probes[MM_STATS_PROBE_BUCKETS];
+    /** @brief Free blocks split to serve a smaller request */
+    size_t splits;
+    /** @brief Freed blocks merged with a free neighbour */
+    size_t coalesces;
+    /** @brief Calls to extend_heap, and the bytes they added */
+    size_t extends;
+    size_t extend_bytes;
+    /** @brief Payload bytes in use now, and at most so far */
+    size_t live_bytes;
+    size_t peak_bytes;
+};
+
+/**
+ * @brief Number of buckets in the histogram of free block sizes. Bucket k
+ * counts free blocks of 16 * 2^k to 16 * 2^(k+1) - 1 bytes, and the last
+ * bucket everything larger.
+ */
+#define MM_FRAG_BUCKETS 20
+
+/**
+ * @brief How the blocks of the heap are laid out at one moment. Sizes
+ * include block headers. Slab runs and blocks with a mapping of their own
+ * are not part of the heap, and are not counted.
+ */
+struct mm_frag {
+    /** @brief Total size of the blocks in the heap */
+    size_t heap_bytes;
+    /** @brief Number and total size of the allocated blocks */
+    size_t alloc_blocks;
+    size_t alloc_bytes;
+    /** @brief Number and total size of the free blocks */
+    size_t free_blocks;
+    size_t free_bytes;
+    /** @brief Size of the largest free block */
+    size_t largest_free;
+    /** @brief Histogram of free block sizes */
+    size_t size_hist[MM_FRAG_BUCKETS];
+    /** @brief Free blocks on each segregated free list (see mm_stats) */
+    size_t list_blocks[MM_STATS_CLASSES];
+    /** @brief Free mini-blocks, and free blocks in the size tree */
+    size_t mini_blocks;
+    size_t tree_blocks;
+    /**
+     * @brief Number and total size of the freed blocks that wait on quick
+     * lists to be coalesced; they are counted as allocated above
+     */
+    size_t quick_blocks;
+    size_t quick_bytes;
+    /**
+     * @brief External fragmentation: the share of the free bytes that lie
+     * outside the largest free block, from 0 (one free block, or none) to
+     * nearly 1 (many small ones)
+     */
+    double external;
+};
+
+/**
+ * @brief Fills in a snapshot of the allocator's statistics.
+ * @param[out] stats Receives the statistics
+ * @return true if mm.c keeps statistics, false if it was built without
+ */
+bool mm_stats(struct mm_stats *stats);
+
+/**
+ * @brief Walks the heap once and reports how fragmented it is.
+ * @param[out] frag Receives the report
+ * @return false if the heap has not been initialized
+ */
+bool mm_fragmentation(struct mm_frag *frag);
+
+#endif /* MM_STATS_H */
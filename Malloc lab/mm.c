@@ -12,11 +12,34 @@
  * first of the corresponding list. Whenever a free block is allocated,
  * coalesced, it will be removed from the list. Every block stores the
  * information including size and whether it is allocated in the header.
+ * Blocks of 16 bytes are mini-blocks: too small for a footer and two links,
+ * they are kept on a singly linked list of their own, and the block after
+ * one is flagged so that coalescing can still find it. Free blocks past a
+ * threshold are kept in a splay tree ordered by size instead of the lists.
+ * Below 1 KiB every block size has a list of its own, so the head of the
+ * list for a request's size always fits it exactly. Small blocks are not
+ * coalesced as soon as they are freed: they wait on quick lists, from which
+ * a request of the same size takes them back at once, and are merged only
+ * when a list grows long or the heap would have to grow. A large free block
+ * left at the end of the heap is given back to memlib, and huge requests
+ * bypass the heap: each one gets a memlib mapping of its own, released
+ * again when it is freed. mm_malloc_batch carves many blocks
+ * of one size from each free block it finds, and mm_free_batch coalesces
+ * blocks that lie side by side as one. mm_free_sized takes the size the
+ * caller asked for, and mm_malloc_usable_size reports the room a block has.
+ * mm_aligned_alloc cuts an aligned payload out of a larger free block and
+ * gives back the free space on either side. A heap grows by a share of its
+ * size at a time, which mm_set_growth tunes. The number of lists, how far
+ * a list is searched and the tree threshold are build options, which
+ * mmtune picks from the traces and writes to mm-classes.h. Each arena
+ * counts what it does, and mm_stats reports the counts; mm_fragmentation
+ * walks the heap to show how its free space is spread out.
  *
  * @author Leo Lin <hungfanl@andrew.cmu.edu>
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -26,6 +49,7 @@
 #include <unistd.h>
 
 #include "memlib.h"
+#include "mm-stats.h"
 #include "mm.h"
 
 /* Do not change the following! */
@@ -70,6 +94,185 @@
 
 #endif
 
+/*
+ * Build options. Each one can be overridden from the compiler command line,
+ * e.g. -DMM_THREADS=1.
+ */
+
+/* Size-class options chosen by mmtune, if it has written them */
+#if defined(__has_include)
+#if __has_include("mm-classes.h")
+#include "mm-classes.h"
+#endif
+#endif
+
+#ifndef MM_THREADS
+/* Make the allocator safe to call from several threads at once */
+#define MM_THREADS 0
+#endif
+
+#ifndef MM_ARENAS
+/* Number of independent heaps; threads are spread over them round-robin */
+#define MM_ARENAS (MM_THREADS ? 4 : 1)
+#endif
+
+#ifndef MM_SLAB_MAX
+/*
+ * Serve requests of up to this many bytes (a multiple of 16, at most 256, or
+ * 0 for none) from slab runs of equal-sized objects. Slab memory cannot be
+ * reused for other sizes, and on the default traces only the smallest class
+ * saves more than that costs.
+ */
+#define MM_SLAB_MAX 16
+#endif
+
+#ifndef MM_COMPRESSED_LINKS
+/*
+ * Store free-list links as 32-bit offsets from mem_heap_lo() instead of
+ * pointers. Blocks must then lie within 64 GiB of the start of the heap.
+ */
+#define MM_COMPRESSED_LINKS 0
+#endif
+
+#ifndef MM_TRIM_THRESHOLD
+/*
+ * Give memory back to memlib when freeing leaves a free block of more than
+ * this many bytes at the end of an arena (0 never trims). The block keeps
+ * chunksize bytes, so that a heap that shrinks and grows again by small
+ * amounts does not call mem_region_sbrk every time.
+ */
+#define MM_TRIM_THRESHOLD (128 << 10)
+#endif
+
+#ifndef MM_MAP_THRESHOLD
+/*
+ * Give requests of at least this many bytes (0 for none) a memlib mapping of
+ * their own, which is released as soon as they are freed, instead of a
+ * block in an arena. They still come from the arena if memlib has no room
+ * for the mapping.
+ */
+#define MM_MAP_THRESHOLD (1 << 20)
+#endif
+
+#ifndef MM_GROW_SHIFT
+/*
+ * Extend an arena by at least 1/2^MM_GROW_SHIFT of its size at a time (0
+ * for chunksize), so that a growing heap calls mem_region_sbrk only a
+ * logarithmic number of times. The arena grows by chunksize instead while
+ * its free blocks add up to that much already.
+ */
+#define MM_GROW_SHIFT 4
+#endif
+
+#ifndef MM_GROW_MAX
+/* Never extend an arena by more than this many bytes beyond its needs */
+#define MM_GROW_MAX (64 << 10)
+#endif
+
+#ifndef MM_CLASS_SUB_BITS
+/* Split each power-of-two size range into 2^MM_CLASS_SUB_BITS free lists */
+#define MM_CLASS_SUB_BITS 2
+#endif
+
+#ifndef MM_FIT_PROBES
+/* Take the smallest of the first this many blocks in a list that fit */
+#define MM_FIT_PROBES 7
+#endif
+
+#ifndef MM_TREE_MIN_SHIFT
+/* Keep free blocks of at least 2^MM_TREE_MIN_SHIFT bytes in the size tree */
+#define MM_TREE_MIN_SHIFT 12
+#endif
+
+#ifndef MM_TUNE
+/*
+ * Make the three options above variables that mm_tune can set between runs,
+ * so that mmtune can try many of them in one process
+ */
+#define MM_TUNE 0
+#endif
+
+#ifndef MM_STATS
+/*
+ * Keep the counters that mm_stats reports. They are only updated by code
+ * that holds the arena lock anyway, at the cost of a few instructions per
+ * call (about 5% of mdriver's throughput); blocks handed out by the thread
+ * caches are counted when the cache takes them from the heap, not each time
+ * it passes them on.
+ */
+#define MM_STATS 1
+#endif
+
+#ifndef MM_CHECK_INTERVAL
+/*
+ * In a DEBUG build, check only the blocks next to those that each call
+ * changes, and the whole arena on every MM_CHECK_INTERVAL-th check (1 to
+ * walk it every time, which makes large traces very slow)
+ */
+#define MM_CHECK_INTERVAL 1024
+#endif
+
+#ifndef MM_QUICK_MAX
+/*
+ * Defer coalescing: keep freed blocks of up to this many bytes (0 for none)
+ * on quick lists of their exact size, still marked as allocated, and hand
+ * them out again to requests of that size. A quick list is merged into the
+ * free lists when it holds more than MM_QUICK_LIMIT blocks, and all of them
+ * are before the heap is extended.
+ */
+#define MM_QUICK_MAX 1024
+#endif
+
+#ifndef MM_QUICK_LIMIT
+#define MM_QUICK_LIMIT 32
+#endif
+
+#if MM_TUNE
+#define MM_TUNABLE static
+#else
+#define MM_TUNABLE static const
+#endif
+
+#if MM_TRIM_THRESHOLD != 0 && MM_TRIM_THRESHOLD < (1 << 12)
+#error "MM_TRIM_THRESHOLD must be 0 or at least chunksize (4096)"
+#endif
+
+#if MM_SLAB_MAX % 16 != 0 || MM_SLAB_MAX > 256
+#error "MM_SLAB_MAX must be a multiple of 16 no larger than 256"
+#endif
+
+#if MM_ARENAS * (1 + (MM_SLAB_MAX > 0)) > MEM_REGIONS
+#error "Not enough memlib regions for MM_ARENAS arenas"
+#endif
+
+#if MM_CLASS_SUB_BITS < 0 || MM_CLASS_SUB_BITS > 5
+#error "MM_CLASS_SUB_BITS must be between 0 and 5"
+#endif
+
+#if MM_QUICK_MAX % 16 != 0 || MM_QUICK_MAX > 1024
+#error "MM_QUICK_MAX must be a multiple of 16 no larger than 1024"
+#endif
+
+#if MM_QUICK_LIMIT < 1
+#error "MM_QUICK_LIMIT must be at least 1"
+#endif
+
+#if MM_CHECK_INTERVAL < 1
+#error "MM_CHECK_INTERVAL must be at least 1"
+#endif
+
+#if MM_FIT_PROBES < 1
+#error "MM_FIT_PROBES must be at least 1"
+#endif
+
+#if MM_TREE_MIN_SHIFT < 8 || MM_TREE_MIN_SHIFT > 20
+#error "MM_TREE_MIN_SHIFT must be between 8 and 20"
+#endif
+
+#if MM_THREADS
+#include <pthread.h>
+#endif
+
 /* Basic constants */
 
 typedef uint64_t word_t;
@@ -80,30 +283,50 @@ static const size_t wsize = sizeof(word_t);
 /** @brief Double word size (bytes) */
 static const size_t dsize = 2 * wsize;
 
-/** @brief Minimum block size (bytes) */
-static const size_t min_block_size = 2 * dsize;
+/**
+ * @brief Minimum block size (bytes). A block of this size is a mini-block:
+ * when free it holds only a header and a `next` link, with no footer.
+ */
+static const size_t min_block_size = dsize;
+
+/** @brief Smallest block kept on the segregated free lists */
+static const size_t min_group_size = 2 * dsize;
 
 /**
- * TODO: The size of heap increase every time we call sbrk(4096 bytes)
- * (Must be divisible by dsize)
+ * @brief Free blocks of at least this size are kept in a splay tree keyed by
+ * size instead of the segregated lists, which gives them an exact best fit.
  */
-static const size_t chunksize = (1 << 12);
+MM_TUNABLE size_t tree_min_size = (size_t)1 << MM_TREE_MIN_SHIFT;
 
 /**
- * TODO: A alloc_mask is used to & with a header to see if this block is freed
- * or allocated.
+ * @brief The smallest amount an arena grows or keeps when trimmed (bytes);
+ * a multiple of dsize. A new arena starts with one free block of this size.
  */
+static const size_t chunksize = (1 << 12);
+
+/** @brief Set in the header of an allocated block */
 static const word_t alloc_mask = 0x1;
-// static int count = 0;
+
+/** @brief Set if the previous block is allocated; its footer is not read */
+static const word_t pre_alloc_mask = 0x2;
+
 /**
- * TODO: To see if the previous block is allocated or not
+ * @brief Set if the previous block is a mini-block, which has no footer to
+ * find it by
  */
-static const word_t pre_alloc_mask = 0x2;
+static const word_t pre_mini_mask = 0x4;
+
+#if MM_MAP_THRESHOLD
+/**
+ * @brief Set in the header of an allocated block that has a mapping of its
+ * own and belongs to no arena
+ */
+static const word_t mapped_mask = 0x8;
+#endif
 
 /**
- * TODO: Since the size must be a multiplication of 16, the last 4 digit of the
- * size will be 0, So the size_mask is used to & with a header to check the size
- * of the block
+ * @brief Block sizes are multiples of 16, which leaves the low 4 bits of a
+ * header for the flags above; this mask keeps the size
  */
 static const word_t size_mask = ~(word_t)0xF;
 
@@ -112,17 +335,36 @@ struct block {
     /** @brief Header contains size + allocation flag */
     word_t header;
     /**
-     * @brief A pointer to the block payload.
-     *
-     * TODO: Besides a header, a block also contian a struct with a next
-     * pointer, a pre pointer, and an array of char(payload) We no longer need
-     * footer.
+     * @brief The payload of an allocated block. A free block keeps its
+     * links here instead, and every free block but a mini-block ends with a
+     * footer that repeats its header.
      */
     union {
         struct {
             struct block *next;
             struct block *pre;
+            union {
+                /** @brief Children and parent of a node of the size tree */
+                struct {
+                    struct block *left;
+                    struct block *right;
+                    struct block *parent;
+                };
+                /**
+                 * @brief The segregated list that a free block larger than
+                 * min_group_size is on, so that it is not computed again
+                 * to take the block off (see list_group)
+                 */
+                word_t group;
+            };
+        };
+#if MM_COMPRESSED_LINKS
+        /** @brief Free-list links of a free block (see encode_link) */
+        struct {
+            uint32_t next_link;
+            uint32_t pre_link;
         };
+#endif
         char payload[0];
     };
 };
@@ -131,10 +373,216 @@ typedef struct block block_t;
 
 /* Global variables */
 
-/** @brief Pointer to first block in the heap */
-static const int group_count = 15;
-static block_t *heap_start = NULL;
-static block_t *list_start[group_count];
+#if MM_COMPRESSED_LINKS
+/** @brief The address that compressed links are relative to */
+static char *link_base;
+
+/** @brief Blocks must start less than this many bytes above link_base */
+static const size_t link_range = (size_t)UINT32_MAX * 16;
+#endif
+
+/**
+ * @brief Number of segregated free lists. Each list owns one bit of
+ * `list_bitmap`, so this must be a multiple of the width of a word.
+ */
+#define GROUP_COUNT 128
+
+#if GROUP_COUNT != MM_STATS_CLASSES
+#error "mm_stats needs a class for every free list"
+#endif
+
+/**
+ * @brief Each power-of-two size range past the exact groups is divided into
+ * 2^class_sub_bits groups of equal width (e.g. 1024-1279, 1280-1535,
+ * 1536-1791, 1792-2047).
+ */
+MM_TUNABLE int class_sub_bits = MM_CLASS_SUB_BITS;
+
+/** @brief Number of fitting blocks find_fit_in_list compares at most */
+MM_TUNABLE int fit_probes = MM_FIT_PROBES;
+
+/**
+ * @brief Every block size below 2^class_min_shift has a list of its own, the
+ * first exact_groups groups; larger sizes share the groups after them.
+ */
+static const int class_min_shift = 10;
+
+/** @brief Number of groups of one block size each, from 32 to 1008 bytes */
+static const int exact_groups = ((1 << 10) - 32) / 16;
+
+#if MM_SLAB_MAX
+/** @brief Size of a slab run, which is also its alignment */
+static const size_t slab_run_size = 1 << 12;
+
+/** @brief Largest request served from a slab run */
+static const size_t slab_max_size = MM_SLAB_MAX;
+
+/** @brief Number of slab classes; class i holds objects of 16 * (i + 1) */
+#define SLAB_CLASSES (MM_SLAB_MAX / 16)
+
+/** @brief Words in a run's occupancy bitmap, enough for 256 objects */
+#define SLAB_MAP_WORDS 4
+
+/**
+ * @brief The header at the start of every slab run. The rest of the run is
+ * an array of objects of one size, which carry no header of their own; a
+ * bitmap records which of them are in use.
+ */
+typedef struct slab_run {
+    /** @brief Links in the partial or empty run list of the arena */
+    struct slab_run *next;
+    struct slab_run *pre;
+    /** @brief Size of the objects, or 0 if the run is on the empty list */
+    uint32_t size;
+    /** @brief Number of objects that fit in the run */
+    uint16_t capacity;
+    /** @brief Number of objects not in use */
+    uint16_t free_count;
+    /** @brief Bit i is set if object i is in use or does not exist */
+    word_t used[SLAB_MAP_WORDS];
+} slab_run_t;
+#endif
+
+/**
+ * @brief An independent heap with its own free lists. Arena i lives in
+ * memlib region i, so the arena of a block can be told from its address.
+ * Its slab runs, if any, are carved from region MM_ARENAS + i.
+ */
+typedef struct arena {
+    /** @brief Pointer to first block in the heap, or NULL until used */
+    block_t *heap_start;
+    /** @brief Heads of the segregated free lists, indexed by calculate_group */
+    block_t *list_start[GROUP_COUNT];
+    /**
+     * @brief Bit i % 64 of word i / 64 is set if and only if list_start[i]
+     * is not empty
+     */
+    word_t list_bitmap[GROUP_COUNT / 64];
+    /** @brief Head of the singly linked LIFO list of free mini-blocks */
+    block_t *mini_start;
+    /** @brief Root of the size tree, or NULL if it is empty */
+    block_t *tree_root;
+    /** @brief The memlib region that holds the heap */
+    int region;
+    /**
+     * @brief No block has been handed out at or above this address since
+     * the region was fresh, so the bytes from here to the end of the heap
+     * are zero apart from the header, links and footer of the free block at
+     * the end (see clear_payload)
+     */
+    char *clean;
+    /** @brief Total size of the blocks on the free lists and in the tree */
+    size_t free_bytes;
+    /** @brief Counters for mm_stats, unused unless MM_STATS is set */
+    struct mm_stats stats;
+    /** @brief Number of debug checks so far (see check_near) */
+    size_t checks;
+#if MM_QUICK_MAX
+    /**
+     * @brief Quick list i holds freed blocks of (i + 1) * 16 bytes that are
+     * not coalesced yet, linked through `next` (see quick_push)
+     */
+    block_t *quick[MM_QUICK_MAX / 16];
+    /** @brief Number of blocks on each quick list */
+    int quick_count[MM_QUICK_MAX / 16];
+#endif
+#if MM_SLAB_MAX
+    /** @brief Runs with at least one free object, per slab class */
+    slab_run_t *slab_partial[SLAB_CLASSES];
+    /** @brief Runs with no object in use, ready for any class */
+    slab_run_t *slab_empty;
+    /** @brief Bounds of the runs carved so far, or NULL before the first */
+    char *slab_lo;
+    char *slab_hi;
+#endif
+#if MM_THREADS
+    /** @brief Protects the heap and the free lists */
+    pthread_mutex_t lock;
+    /**
+     * @brief Queue of blocks freed by threads that do not allocate from this
+     * arena. It is a linked list through `next` that always holds at least
+     * `remote_stub`; other threads append at `remote_tail` without locking,
+     * and the holder of `lock` takes blocks off at `remote_head`.
+     */
+    block_t *remote_head;
+    block_t *remote_tail;
+    block_t remote_stub;
+#endif
+} arena_t;
+
+/** @brief All arenas. Arena 0 is the one set up by mm_init */
+#if MM_THREADS
+static arena_t arenas[MM_ARENAS] = {
+    [0 ... MM_ARENAS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER}};
+#else
+static arena_t arenas[MM_ARENAS];
+#endif
+
+#if MM_THREADS
+/**
+ * @brief Counters for blocks with a mapping of their own, which are freed
+ * without an arena lock; they have a lock of their own instead. In the
+ * single-threaded build these blocks are counted in arena 0.
+ */
+static struct mm_stats mapped_stats;
+static pthread_mutex_t mapped_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/** @brief How arenas grow, as set by mm_set_growth (see MM_GROW_SHIFT) */
+static unsigned int grow_shift = MM_GROW_SHIFT;
+static size_t grow_max = MM_GROW_MAX;
+
+#if MM_THREADS
+/**
+ * @brief Largest request served from the per-thread caches. Blocks that can
+ * hold such a request are recycled by the thread that frees them without
+ * taking a lock.
+ */
+static const size_t tcache_max_size = 256;
+
+/**
+ * @brief Number of thread cache bins. Bin i holds blocks with room for at
+ * least 16 * (i + 1) bytes, which serve requests of 16 * i + 1 and up.
+ */
+#define TCACHE_BINS 16
+
+/** @brief Number of blocks moved between a thread cache and the heap at once */
+static const int tcache_batch = 8;
+
+/** @brief Maximum number of blocks a single bin may hold */
+static const int tcache_bin_limit = 32;
+
+/**
+ * @brief A thread's private stock of small blocks. The blocks are allocated
+ * as far as the heap is concerned; they are chained through `next`. Slab
+ * objects have no header, so only the payload of a cached block is valid.
+ */
+struct tcache {
+    /** @brief The arena the thread allocates from, or NULL until assigned */
+    arena_t *arena;
+    /** @brief The heap_generation the cached blocks belong to */
+    unsigned long generation;
+    /** @brief Whether the exit destructor has been set up for this thread */
+    bool registered;
+    /** @brief Number of blocks in each bin */
+    int count[TCACHE_BINS];
+    /** @brief Stacks of cached blocks, indexed by tcache_index */
+    block_t *bin[TCACHE_BINS];
+};
+
+/** @brief Counter used to hand arenas out to threads round-robin */
+static unsigned int next_arena = 0;
+
+/** @brief Incremented by mm_init so that stale thread caches are dropped */
+static unsigned long heap_generation = 0;
+
+/** @brief Used to give cached blocks back when a thread exits */
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+/** @brief The calling thread's cache */
+static __thread struct tcache tcache;
+#endif
 /*
  *****************************************************************************
  * The functions below are short wrapper functions to perform                *
@@ -177,39 +625,28 @@ static size_t round_up(size_t size, size_t n) {
 
 /**
  * @brief get the group that a freed block belongs to increase utilization
+ *
+ * A block of less than 2^class_min_shift bytes goes to the group of its exact
+ * size, so that any block on that list fits a request of the same size. For
+ * larger blocks, the position of the highest set bit selects the power-of-two
+ * range, and the next class_sub_bits bits below it select the subrange. Every
+ * size larger than the last group's lower bound falls into the last group.
+ *
  * @param[in] size
  * @return The group that the block belongs
+ * @pre `size >= min_group_size`
  */
 static int calculate_group(size_t size) {
-    if (size < 33)
-        return 0;
-    if (size < 49)
-        return 1;
-    if (size < 65)
-        return 2;
-    if (size < 81)
-        return 3;
-    if (size < 161)
-        return 4;
-    if (size < 321)
-        return 5;
-    if (size < 433)
-        return 6;
-    if (size < 641)
-        return 7;
-    if (size < 840)
-        return 8;
-    if (size < 1500)
-        return 9;
-    if (size < 2000)
-        return 10;
-    if (size < 3000)
-        return 11;
-    if (size < 5000)
-        return 12;
-    if (size < 10000)
-        return 13;
-    return 14;
+    dbg_requires(size >= min_group_size);
+    if (size >> class_min_shift == 0) {
+        return (int)((size - min_group_size) / dsize);
+    }
+    int msb = 63 - __builtin_clzl(size);
+    int sub = (int)(size >> (msb - class_sub_bits)) &
+              ((1 << class_sub_bits) - 1);
+    int group =
+        exact_groups + ((msb - class_min_shift) << class_sub_bits) + sub;
+    return group < GROUP_COUNT - 1 ? group : GROUP_COUNT - 1;
 }
 
 /**
@@ -286,6 +723,8 @@ static void *header_to_payload(block_t *block) {
 static word_t *header_to_footer(block_t *block) {
     dbg_requires(get_size(block) != 0 &&
                  "Called header_to_footer on the epilogue block");
+    dbg_requires(get_size(block) != min_block_size &&
+                 "Called header_to_footer on a mini-block");
     return (word_t *)(block->payload + get_size(block) - dsize);
 }
 
@@ -360,162 +799,572 @@ static bool get_pre_alloc(block_t *block) {
 }
 
 /**
- * @brief Remove a Node from the list.
+ * @brief Returns whether the previous block is a mini-block, based on the
+ * header of a block.
+ * @param[in] block
+ * @return The pre_mini status of the block
  */
-static void remove_from_list(block_t *block) {
-    int i = calculate_group(get_size(block));
-    if (block == list_start[i]) {
-        // The block is the only Node in the list.
-        if (block->next == NULL) {
-            list_start[i] = NULL;
-        }
-        // There are other Nodes in the list.
-        else {
-            block->next->pre = NULL;
-            list_start[i] = block->next;
-            block->next = NULL;
-        }
-    } else {
-        if (block->next == NULL) {
-            block->pre->next = NULL;
-            block->pre = NULL;
-        } else {
-            block->pre->next = block->next;
-            block->next->pre = block->pre;
-            block->pre = NULL;
-            block->next = NULL;
-        }
-    }
+static bool get_pre_mini(block_t *block) {
+    return (bool)(block->header & pre_mini_mask);
 }
 
+#if MM_COMPRESSED_LINKS
 /**
- * @brief Add the Node to the first Node of the List.
- *
- *
+ * @brief Compresses a pointer to a block into a 32-bit link: the number of
+ * 16-byte steps from mem_heap_lo() to the block's payload, or 0 for NULL.
+ * @param[in] block A block below mem_heap_lo() + link_range, or NULL
+ * @return The link
  */
-static void add_to_first(block_t *block) {
-    int i = calculate_group(get_size(block));
-    if (list_start[i] == NULL) {
-        block->next = NULL;
-        list_start[i] = block;
+static uint32_t encode_link(block_t *block) {
+    if (block == NULL) {
+        return 0;
     }
+    dbg_requires((char *)block >= link_base &&
+                 (size_t)((char *)block - link_base) < link_range);
+    return (uint32_t)(((char *)block->payload - link_base) / dsize);
+}
 
-    else {
-        block->next = list_start[i];
-        list_start[i]->pre = block;
-        list_start[i] = block;
+/**
+ * @brief Expands a 32-bit link back into a pointer to a block.
+ * @param[in] link A link made by encode_link
+ * @return The block, or NULL
+ */
+static block_t *decode_link(uint32_t link) {
+    if (link == 0) {
+        return NULL;
     }
+    return payload_to_header(link_base + (size_t)link * dsize);
 }
+#endif
 
 /**
- * @brief Writes an epilogue header at the given address.
- *
- * The epilogue header has size 0, and is marked as allocated.
- *
- * @param[out] block The location to write the epilogue header
+ * @brief Returns the block after a free block in its free list.
+ * @param[in] block A free block
+ * @return The next block in the list, or NULL
  */
-static void write_epilogue(block_t *block) {
-    dbg_requires(block != NULL);
-    dbg_requires((char *)block == mem_heap_hi() - 7);
-    block->header = pack(0, true);
+static block_t *get_next(block_t *block) {
+#if MM_COMPRESSED_LINKS
+    return decode_link(block->next_link);
+#else
+    return block->next;
+#endif
 }
 
 /**
- * @brief Writes a block starting at the given address.
- *
- * @param[out] block The location to begin writing the block header
- * @param[in] size The size of the new block
- * @param[in] alloc The allocation status of the new block
+ * @brief Returns the block before a free block in its free list.
+ * @param[in] block A free block, which must not be a mini-block unless links
+ * are compressed
+ * @return The previous block in the list, or anything if `block` is the
+ * head of the list
  */
-static void write_block(block_t *block, size_t size, bool alloc) {
-    dbg_requires(block != NULL);
-    dbg_requires(size > 0);
-    block->header = pack(size, alloc);
-    word_t *footerp = header_to_footer(block);
-    *footerp = pack(size, alloc);
+static block_t *get_pre(block_t *block) {
+#if MM_COMPRESSED_LINKS
+    return decode_link(block->pre_link);
+#else
+    return block->pre;
+#endif
 }
 
 /**
- * @brief Writes a block starting at the given address.
- *
- * TODO: Are there any preconditions or postconditions?
- *
- * @param[out] block The location to begin writing the block header
- * @param[in] size The size of the new block
- * @param[in] alloc The allocation status of the new block
+ * @brief Sets the block after a free block in its free list.
+ * @param[out] block A free block
+ * @param[in] next The next block, or NULL
  */
-static void write_header(block_t *block, size_t size, bool alloc) {
-    dbg_requires(block != NULL);
-    dbg_requires(size > 0);
-    block->header = pack(size, alloc);
+static void set_next(block_t *block, block_t *next) {
+#if MM_COMPRESSED_LINKS
+    block->next_link = encode_link(next);
+#else
+    block->next = next;
+#endif
 }
 
 /**
- * @brief Writes a block starting at the given address.
- *
- * @param[out] block The location to begin writing the block header
- * @param[in] size The size of the new block
- * @param[in] alloc The allocation status of the new block
+ * @brief Sets the block before a free block in its free list.
+ * @param[out] block A free block, which must not be a mini-block unless
+ * links are compressed
+ * @param[in] pre The previous block, or NULL
  */
-static void write_pre_alloc(block_t *block, bool pre_alloc) {
-    size_t size = extract_size(block->header);
-    bool alloc = extract_alloc(block->header);
-    if (alloc) {
-        size |= alloc_mask;
-    }
-    if (pre_alloc) {
-        size |= pre_alloc_mask;
+static void set_pre(block_t *block, block_t *pre) {
+#if MM_COMPRESSED_LINKS
+    block->pre_link = encode_link(pre);
+#else
+    block->pre = pre;
+#endif
+}
+
+/**
+ * @brief Unlinks a block from a doubly linked free list.
+ * @param[in,out] head The head of the list
+ * @param[in] block A block on the list
+ * @return true if the list is now empty
+ */
+static bool unlink_block(block_t **head, block_t *block) {
+    block_t *next = get_next(block);
+    if (block == *head) {
+        // The block is the first Node in the list.
+        *head = next;
+    } else {
+        set_next(get_pre(block), next);
     }
-    block->header = size;
-    if (!alloc) {
-        word_t *footerp = header_to_footer(block);
-        *footerp = size;
+    if (next != NULL) {
+        set_pre(next, get_pre(block));
     }
+    return *head == NULL;
 }
 
 /**
- * @brief Finds the next consecutive block on the heap.
- *
- * This function accesses the next block in the "implicit list" of the heap
- * by adding the size of the block.
- *
- * @param[in] block A block in the heap
- * @return The next consecutive block on the heap
- * @pre The block is not the epilogue
+ * @brief Unlinks a free mini-block. Without compressed links the list is
+ * singly linked, so the block is looked for from the head; recently freed
+ * mini-blocks are near it.
  */
-static block_t *find_next(block_t *block) {
-    dbg_requires(block != NULL);
-    dbg_requires(get_size(block) != 0 &&
-                 "Called find_next on the last block in the heap");
-    return (block_t *)((char *)block + get_size(block));
+static void remove_mini(arena_t *a, block_t *block) {
+#if MM_COMPRESSED_LINKS
+    unlink_block(&a->mini_start, block);
+#else
+    block_t **link = &a->mini_start;
+    while (*link != block) {
+        link = &(*link)->next;
+    }
+    *link = block->next;
+#endif
 }
 
+/*
+ * The size tree is a splay tree of free blocks of at least tree_min_size
+ * bytes, built the same way as the one in stree.c but stored in the blocks
+ * themselves. Each node is the first of the free blocks of its size; the
+ * others hang off it on a list through `next` and `pre`, and only a node has
+ * `pre == NULL`.
+ */
+
 /**
- * @brief Finds the footer of the previous block on the heap.
- * @param[in] block A block in the heap
- * @return The location of the previous block's footer
+ * @brief Makes the right child of a node take its place.
+ * @param[in] a The arena whose tree holds the node
+ * @param[in] x A node with a right child
  */
-static word_t *find_prev_footer(block_t *block) {
-    // Compute previous footer position as one word before the header
-    return &(block->header) - 1;
+static void tree_rotate_left(arena_t *a, block_t *x) {
+    block_t *y = x->right;
+    x->right = y->left;
+    if (y->left != NULL) {
+        y->left->parent = x;
+    }
+    y->parent = x->parent;
+    if (x->parent == NULL) {
+        a->tree_root = y;
+    } else if (x == x->parent->left) {
+        x->parent->left = y;
+    } else {
+        x->parent->right = y;
+    }
+    y->left = x;
+    x->parent = y;
 }
 
 /**
- * @brief Finds the previous consecutive block on the heap.
- * This is the previous block in the "implicit list" of the heap.
+ * @brief Makes the left child of a node take its place.
+ * @param[in] a The arena whose tree holds the node
+ * @param[in] x A node with a left child
+ */
+static void tree_rotate_right(arena_t *a, block_t *x) {
+    block_t *y = x->left;
+    x->left = y->right;
+    if (y->right != NULL) {
+        y->right->parent = x;
+    }
+    y->parent = x->parent;
+    if (x->parent == NULL) {
+        a->tree_root = y;
+    } else if (x == x->parent->left) {
+        x->parent->left = y;
+    } else {
+        x->parent->right = y;
+    }
+    y->right = x;
+    x->parent = y;
+}
+
+/**
+ * @brief Moves a node to the root of the tree by zig, zig-zig and zig-zag
+ * steps, which keeps the cost of tree operations O(log n) amortized.
+ * @param[in] a The arena whose tree holds the node
+ * @param[in] x The node
+ */
+static void tree_splay(arena_t *a, block_t *x) {
+    while (x->parent != NULL) {
+        block_t *p = x->parent;
+        block_t *g = p->parent;
+        if (g == NULL) {
+            if (p->left == x) {
+                tree_rotate_right(a, p);
+            } else {
+                tree_rotate_left(a, p);
+            }
+        } else if (p->left == x && g->left == p) {
+            tree_rotate_right(a, g);
+            tree_rotate_right(a, p);
+        } else if (p->right == x && g->right == p) {
+            tree_rotate_left(a, g);
+            tree_rotate_left(a, p);
+        } else if (p->left == x) {
+            tree_rotate_right(a, p);
+            tree_rotate_left(a, g);
+        } else {
+            tree_rotate_left(a, p);
+            tree_rotate_right(a, g);
+        }
+    }
+}
+
+/**
+ * @brief Puts the subtree rooted at `v` where the node `u` is.
+ * @param[in] a The arena whose tree holds the node
+ * @param[in] u A node
+ * @param[in] v A node, or NULL
+ */
+static void tree_replace(arena_t *a, block_t *u, block_t *v) {
+    if (u->parent == NULL) {
+        a->tree_root = v;
+    } else if (u == u->parent->left) {
+        u->parent->left = v;
+    } else {
+        u->parent->right = v;
+    }
+    if (v != NULL) {
+        v->parent = u->parent;
+    }
+}
+
+/**
+ * @brief Finds the smallest node of a subtree.
+ * @param[in] u The root of the subtree
+ * @return The leftmost node under `u`
+ */
+static block_t *tree_minimum(block_t *u) {
+    while (u->left != NULL) {
+        u = u->left;
+    }
+    return u;
+}
+
+/**
+ * @brief Adds a free block to the size tree: to the list of an existing node
+ * of the same size, or else as a new node, which is splayed to the root.
+ * @param[in] a The arena
+ * @param[in] block A free block of at least tree_min_size bytes
+ */
+static void tree_insert(arena_t *a, block_t *block) {
+    size_t size = get_size(block);
+    block_t *z = a->tree_root;
+    block_t *p = NULL;
+    while (z != NULL) {
+        if (size == get_size(z)) {
+            block->next = z->next;
+            block->pre = z;
+            if (z->next != NULL) {
+                z->next->pre = block;
+            }
+            z->next = block;
+            return;
+        }
+        p = z;
+        z = size > get_size(z) ? z->right : z->left;
+    }
+    block->next = NULL;
+    block->pre = NULL;
+    block->left = NULL;
+    block->right = NULL;
+    block->parent = p;
+    if (p == NULL) {
+        a->tree_root = block;
+    } else if (size > get_size(p)) {
+        p->right = block;
+    } else {
+        p->left = block;
+    }
+    tree_splay(a, block);
+}
+
+/**
+ * @brief Removes a free block from the size tree. A node with other blocks
+ * of its size is replaced by the next of them; otherwise it is deleted the
+ * way stree.c deletes a node, without splaying it first: the blocks removed
+ * by coalescing are not likely to be looked for again.
+ * @param[in] a The arena
+ * @param[in] block A block in the tree
+ */
+static void tree_remove(arena_t *a, block_t *block) {
+    if (block->pre != NULL) {
+        // Not a node: just unlink it from its node's list
+        block->pre->next = block->next;
+        if (block->next != NULL) {
+            block->next->pre = block->pre;
+        }
+        return;
+    }
+    block_t *y = block->next;
+    if (y != NULL) {
+        y->pre = NULL;
+        y->left = block->left;
+        y->right = block->right;
+        if (y->left != NULL) {
+            y->left->parent = y;
+        }
+        if (y->right != NULL) {
+            y->right->parent = y;
+        }
+        tree_replace(a, block, y);
+        return;
+    }
+    if (block->left == NULL) {
+        tree_replace(a, block, block->right);
+    } else if (block->right == NULL) {
+        tree_replace(a, block, block->left);
+    } else {
+        y = tree_minimum(block->right);
+        if (y->parent != block) {
+            tree_replace(a, y, y->right);
+            y->right = block->right;
+            y->right->parent = y;
+        }
+        tree_replace(a, block, y);
+        y->left = block->left;
+        y->left->parent = y;
+    }
+}
+
+/**
+ * @brief Finds the smallest free block in the size tree that holds `asize`
+ * bytes. Its node is splayed to the root.
+ * @param[in] a The arena
+ * @param[in] asize The required size
+ * @return The block, or NULL if none is large enough
+ */
+static block_t *tree_find_fit(arena_t *a, size_t asize) {
+    block_t *z = a->tree_root;
+    block_t *best = NULL;
+    while (z != NULL) {
+        if (get_size(z) == asize) {
+            best = z;
+            break;
+        }
+        if (get_size(z) > asize) {
+            best = z;
+            z = z->left;
+        } else {
+            z = z->right;
+        }
+    }
+    if (best == NULL) {
+        return NULL;
+    }
+    tree_splay(a, best);
+    // Taking a block off the node's list leaves the tree as it is
+    return best->next != NULL ? best->next : best;
+}
+
+/**
+ * @brief Returns the segregated list that a free block is on, as add_to_first
+ * recorded it. A block of min_group_size has no room to record it, since its
+ * links and footer fill it, but it is always on the first list.
+ *
+ * @param[in] block A free block on a segregated list
+ * @return The group of the block
+ */
+static int list_group(block_t *block) {
+    if (get_size(block) == min_group_size) {
+        return 0;
+    }
+    return (int)block->group;
+}
+
+/**
+ * @brief Remove a Node from the list.
+ */
+static void remove_from_list(arena_t *a, block_t *block) {
+    a->free_bytes -= get_size(block);
+    if (get_size(block) == min_block_size) {
+        remove_mini(a, block);
+        return;
+    }
+    if (get_size(block) >= tree_min_size) {
+        tree_remove(a, block);
+        return;
+    }
+    int i = list_group(block);
+    if (unlink_block(&a->list_start[i], block)) {
+        a->list_bitmap[i / 64] &= ~((word_t)1 << (i % 64));
+    }
+}
+
+/**
+ * @brief Add the Node to the first Node of the List.
+ *
+ *
+ */
+static void add_to_first(arena_t *a, block_t *block) {
+    a->free_bytes += get_size(block);
+    if (get_size(block) >= tree_min_size) {
+        tree_insert(a, block);
+        return;
+    }
+    block_t **head;
+    if (get_size(block) == min_block_size) {
+        head = &a->mini_start;
+    } else {
+        int i = calculate_group(get_size(block));
+        if (get_size(block) > min_group_size) {
+            block->group = (word_t)i;
+        }
+        head = &a->list_start[i];
+        a->list_bitmap[i / 64] |= (word_t)1 << (i % 64);
+    }
+    set_next(block, *head);
+    // A mini-block only has room for a back link when links are compressed
+    if (*head != NULL && (MM_COMPRESSED_LINKS || head != &a->mini_start)) {
+        set_pre(*head, block);
+    }
+    *head = block;
+}
+
+/**
+ * @brief Writes an epilogue header at the given address.
+ *
+ * The epilogue header has size 0, and is marked as allocated.
+ *
+ * @param[out] block The location to write the epilogue header
+ */
+static void write_epilogue(block_t *block) {
+    dbg_requires(block != NULL);
+    dbg_requires((char *)block ==
+                 (char *)mem_region_hi(mem_region_of(block)) - 7);
+    block->header = pack(0, true);
+}
+
+/**
+ * @brief Writes a block starting at the given address, with a footer unless
+ * it is a mini-block. The flags that describe the previous block are kept.
+ *
+ * @param[out] block The location to begin writing the block header
+ * @param[in] size The size of the new block
+ * @param[in] alloc The allocation status of the new block
+ */
+static void write_block(block_t *block, size_t size, bool alloc) {
+    dbg_requires(block != NULL);
+    dbg_requires(size > 0);
+    block->header =
+        pack(size, alloc) | (block->header & (pre_alloc_mask | pre_mini_mask));
+    if (size != min_block_size) {
+        word_t *footerp = header_to_footer(block);
+        *footerp = block->header;
+    }
+}
+
+/**
+ * @brief Writes the header of a block starting at the given address. The
+ * flags that describe the previous block are kept.
+ *
+ * @param[out] block The location to begin writing the block header
+ * @param[in] size The size of the new block
+ * @param[in] alloc The allocation status of the new block
+ */
+static void write_header(block_t *block, size_t size, bool alloc) {
+    dbg_requires(block != NULL);
+    dbg_requires(size > 0);
+    block->header =
+        pack(size, alloc) | (block->header & (pre_alloc_mask | pre_mini_mask));
+}
+
+/**
+ * @brief Sets or clears one of the flags that describe the previous block,
+ * in the header of a block and in its footer if it has one.
+ *
+ * @param[out] block The block to update
+ * @param[in] mask pre_alloc_mask or pre_mini_mask
+ * @param[in] set Whether the flag is to be set
+ */
+static void write_pre_flag(block_t *block, word_t mask, bool set) {
+    word_t word = block->header & ~mask;
+    if (set) {
+        word |= mask;
+    }
+#if MM_THREADS
+    // The owner of an allocated block may be reading this header without
+    // holding the arena's lock (see usable_size_unlocked)
+    __atomic_store_n(&block->header, word, __ATOMIC_RELAXED);
+#else
+    block->header = word;
+#endif
+    if (!extract_alloc(word) && extract_size(word) > min_block_size) {
+        word_t *footerp = header_to_footer(block);
+        *footerp = word;
+    }
+}
+
+/**
+ * @brief Records whether the block before `block` is allocated.
+ * @param[out] block The block to update, which may be the epilogue
+ * @param[in] pre_alloc The allocation status of the previous block
+ */
+static void write_pre_alloc(block_t *block, bool pre_alloc) {
+    write_pre_flag(block, pre_alloc_mask, pre_alloc);
+}
+
+/**
+ * @brief Records whether the block before `block` is a mini-block.
+ * @param[out] block The block to update, which may be the epilogue
+ * @param[in] pre_mini Whether the previous block is a mini-block
+ */
+static void write_pre_mini(block_t *block, bool pre_mini) {
+    write_pre_flag(block, pre_mini_mask, pre_mini);
+}
+
+/**
+ * @brief Finds the next consecutive block on the heap.
+ *
+ * This function accesses the next block in the "implicit list" of the heap
+ * by adding the size of the block.
+ *
+ * @param[in] block A block in the heap
+ * @return The next consecutive block on the heap
+ * @pre The block is not the epilogue
+ */
+static block_t *find_next(block_t *block) {
+    dbg_requires(block != NULL);
+    dbg_requires(get_size(block) != 0 &&
+                 "Called find_next on the last block in the heap");
+    return (block_t *)((char *)block + get_size(block));
+}
+
+/**
+ * @brief Finds the footer of the previous block on the heap.
+ * @param[in] block A block in the heap
+ * @return The location of the previous block's footer
+ */
+static word_t *find_prev_footer(block_t *block) {
+    // Compute previous footer position as one word before the header
+    return &(block->header) - 1;
+}
+
+/**
+ * @brief Finds the previous consecutive block on the heap.
+ * This is the previous block in the "implicit list" of the heap.
  *
  * If the function is called on the first block in the heap, NULL will be
  * returned, since the first block in the heap has no previous block!
  *
  * The position of the previous block is found by reading the previous
  * block's footer to determine its size, then calculating the start of the
- * previous block based on its size.
+ * previous block based on its size. A mini-block has no footer, but its size
+ * is known from the pre_mini flag.
  *
  * @param[in] block A block in the heap
  * @return The previous consecutive block in the heap.
  */
 static block_t *find_prev(block_t *block) {
     dbg_requires(block != NULL);
+    if (get_pre_mini(block)) {
+        return (block_t *)((char *)block - min_block_size);
+    }
     word_t *footerp = find_prev_footer(block);
 
     // Return NULL if called on first block in the heap
@@ -534,6 +1383,79 @@ static block_t *find_prev(block_t *block) {
 
 /******** The remaining content below are helper and debug routines ********/
 
+/**
+ * @brief Records that the memory below an address may hold data, so that
+ * calloc no longer takes it to be clean.
+ *
+ * @param[in] a The arena
+ * @param[in] end The end of the memory that may have been written
+ */
+static void mark_dirty(arena_t *a, void *end) {
+    if ((char *)end > a->clean) {
+        a->clean = end;
+    }
+}
+
+/**
+ * @brief Counts a block handed out or given back, if MM_STATS is set. The
+ * block's class is the free list that a free block of its size goes on.
+ *
+ * @param[in] s The counters of the arena that holds the block
+ * @param[in] usable The usable size of the block
+ * @param[in] alloc true if the block was handed out, false if it was freed
+ */
+static void stats_count(struct mm_stats *s, size_t usable, bool alloc) {
+    if (!MM_STATS) {
+        return;
+    }
+    int i = calculate_group(max(usable + wsize, min_group_size));
+    if (alloc) {
+        s->allocs[i]++;
+        s->live_bytes += usable;
+        s->peak_bytes = max(s->peak_bytes, s->live_bytes);
+    } else {
+        s->frees[i]++;
+        s->live_bytes -= usable;
+    }
+}
+
+/**
+ * @brief Counts an allocated block that has changed size in place, if
+ * MM_STATS is set.
+ *
+ * @param[in] s The counters of the arena that holds the block
+ * @param[in] old_usable The usable size of the block before
+ * @param[in] new_usable The usable size of the block now
+ */
+static void stats_resize(struct mm_stats *s, size_t old_usable,
+                         size_t new_usable) {
+    if (!MM_STATS) {
+        return;
+    }
+    s->live_bytes += new_usable - old_usable;
+    s->peak_bytes = max(s->peak_bytes, s->live_bytes);
+}
+
+/**
+ * @brief Counts a block handed out or given back that has a mapping of its
+ * own, if MM_STATS is set.
+ *
+ * @param[in] usable The usable size of the block
+ * @param[in] alloc true if the block was handed out, false if it was freed
+ */
+static void stats_count_mapped(size_t usable, bool alloc) {
+    if (!MM_STATS) {
+        return;
+    }
+#if MM_THREADS
+    pthread_mutex_lock(&mapped_stats_lock);
+    stats_count(&mapped_stats, usable, alloc);
+    pthread_mutex_unlock(&mapped_stats_lock);
+#else
+    stats_count(&arenas[0].stats, usable, alloc);
+#endif
+}
+
 /**
  * @brief This function examine the previous block and the next block,
  * 1. Check if the next block is freed (get_alloc == false),
@@ -553,26 +1475,32 @@ static block_t *find_prev(block_t *block) {
  * block before and after.
  * @return A pointer pointing to the header of a block.
  */
-static block_t *coalesce_block(block_t *block) {
+static block_t *coalesce_block(arena_t *a, block_t *block) {
     // 1. Find if the next block is freed, combined the two blocks
-    size_t block_size = get_size(block);
+    size_t size = get_size(block);
+    size_t block_size = size;
     block_t *next_block = find_next(block);
-    bool pre_allocate = get_pre_alloc(block);
     if (!get_alloc(next_block)) {
-        remove_from_list(next_block);
+        remove_from_list(a, next_block);
+        // Its header and links are left behind inside the merged block
+        mark_dirty(a, (char *)next_block + sizeof(block_t));
         block_size += get_size(next_block);
         write_block(block, block_size, false);
-        write_pre_alloc(block, true);
-        write_pre_alloc(find_next(block), false);
     }
-    if (!pre_allocate) {
+    if (!get_pre_alloc(block)) {
         block_t *pre_block = find_prev(block);
-        remove_from_list(pre_block);
+        remove_from_list(a, pre_block);
         block_size += get_size(pre_block);
         block = pre_block;
+        // The pre_alloc of pre_block must be 1, and is kept
         write_block(block, block_size, false);
-        // The pre_alloc of pre_block must be 1
-        write_pre_alloc(block, true);
+    }
+    if (block_size != size) {
+        // A merged block is never a mini-block
+        write_pre_mini(find_next(block), false);
+        if (MM_STATS) {
+            a->stats.coalesces++;
+        }
     }
     return block;
 }
@@ -594,32 +1522,55 @@ static block_t *coalesce_block(block_t *block) {
  * @return The pointer to the header of the newly created block if created
  * successfully Null if not.
  */
-static block_t *extend_heap(size_t size) {
+static block_t *extend_heap(arena_t *a, size_t size) {
     void *bp;
 
+    // mem_region_sbrk takes a signed increment
+    if (size > INTPTR_MAX - dsize) {
+        return NULL;
+    }
     // Allocate an even number of words to maintain alignment
     size = round_up(size, dsize);
-    if ((bp = mem_sbrk(size)) == (void *)-1) {
+#if MM_COMPRESSED_LINKS
+    // A block out of reach of a 32-bit link could not be put on a list
+    if ((size_t)((char *)mem_region_hi(a->region) - link_base) + size >=
+        link_range) {
         return NULL;
     }
-    // Initialize free block header/footer
+#endif
+    char *fresh = mem_region_fresh(a->region);
+    if ((bp = mem_region_sbrk(a->region, size)) == (void *)-1) {
+        return NULL;
+    }
+    if (fresh > (char *)bp) {
+        // Memory that the region held before may still hold old data
+        mark_dirty(a, fresh < (char *)bp + size ? fresh : (char *)bp + size);
+    }
+    // Initialize free block header/footer, over the old epilogue
     block_t *block = payload_to_header(bp);
-    bool pre_allocate = get_pre_alloc(block);
     write_block(block, size, false);
-    write_pre_alloc(block, pre_allocate);
     // Create new epilogue header
     block_t *block_next = find_next(block);
     write_epilogue(block_next);
-    block = coalesce_block(block);
-    add_to_first(block);
-    return block;
+    write_pre_mini(block_next, size == min_block_size);
+    block_t *merged = coalesce_block(a, block);
+    if (merged != block) {
+        // Clear the old footer and header, now inside the merged block
+        memset((char *)bp - dsize, 0, dsize);
+    }
+    add_to_first(a, merged);
+    if (MM_STATS) {
+        a->stats.extends++;
+        a->stats.extend_bytes += size;
+    }
+    return merged;
 }
 
 /**
  * @brief This function split a block that to two smaller blocks under two
  * conditions
  * 1. The first block is equal to asize(the requested size)
- * 2. Both block is bigger than the min_block_size(2 * dsize)
+ * 2. Both block is bigger than the min_block_size(dsize)
  * After spliting, change the header and the footer of the two blocks.
  * Note: the first block is marked as allocted and the second block is marked as
  * not allocated.
@@ -629,90 +1580,472 @@ static block_t *extend_heap(size_t size) {
  * @param[in] block The block that needs to be split and the size to keep
  * @param[in] asize The size that is need for allocation
  */
-static void split_block(block_t *block, size_t asize) {
+static void split_block(arena_t *a, block_t *block, size_t asize) {
     dbg_requires(get_alloc(block));
 
     size_t block_size = get_size(block);
 
     if ((block_size - asize) >= min_block_size) {
         block_t *block_next;
-        bool pre_allocate = get_pre_alloc(block);
         write_header(block, asize, true);
-        write_pre_alloc(block, pre_allocate);
         block_next = find_next(block);
+        // The new block follows an allocated block, possibly a mini-block
+        block_next->header = pre_alloc_mask;
         write_block(block_next, block_size - asize, false);
-        write_pre_alloc(block_next, true);
+        write_pre_mini(block_next, asize == min_block_size);
         write_pre_alloc(find_next(block_next), false);
-        add_to_first(block_next);
+        write_pre_mini(find_next(block_next),
+                       block_size - asize == min_block_size);
+        add_to_first(a, block_next);
+        if (MM_STATS) {
+            a->stats.splits++;
+        }
     }
 
     dbg_ensures(get_alloc(block));
 }
 
 /**
- * @brief Iterate through whole heap to find a block that is
+ * @brief Merge the free block that follows an allocated block into it.
+ *
+ * The merged block stays allocated; it is left to the caller to split off
+ * whatever part of it is not needed.
+ *
+ * @param[in] block An allocated block whose next block is free
+ */
+static void absorb_next(arena_t *a, block_t *block) {
+    dbg_requires(get_alloc(block));
+    block_t *block_next = find_next(block);
+    dbg_requires(!get_alloc(block_next));
+
+    remove_from_list(a, block_next);
+    size_t block_size = get_size(block) + get_size(block_next);
+    write_header(block, block_size, true);
+    write_pre_alloc(find_next(block), true);
+    write_pre_mini(find_next(block), false);
+
+    dbg_ensures(get_alloc(block));
+}
+
+/**
+ * @brief Look through one free list for a block of at least `asize` bytes.
+ * Among the first fit_probes blocks that fit, the smallest one is chosen. The
+ * blocks of an exact group all have the same size, so the first one is.
+ *
+ * @param[in] a The arena that owns the list, whose counters record how many
+ * blocks were looked at
+ * @param[in] i The group of the list
+ * @param[in] asize The required size
+ * @return The address of the found block, or NULL if none fits
+ */
+static block_t *find_fit_in_list(arena_t *a, int i, size_t asize) {
+    block_t *cur_node = a->list_start[i];
+    block_t *last_node = NULL;
+    int probes = i < exact_groups ? 1 : fit_probes;
+    int j = 0;
+    size_t seen = 0;
+    while (cur_node != NULL) {
+        seen++;
+        if (!(get_alloc(cur_node)) && (asize <= get_size(cur_node))) {
+            j++;
+            if (last_node == NULL || get_size(cur_node) < get_size(last_node)) {
+                last_node = cur_node;
+            }
+        }
+        cur_node = get_next(cur_node);
+        if (j == probes) {
+            break;
+        }
+    }
+    if (MM_STATS) {
+        int bucket = seen == 0 ? 0 : 64 - __builtin_clzl(seen);
+        bucket = bucket < MM_STATS_PROBE_BUCKETS ? bucket
+                                                 : MM_STATS_PROBE_BUCKETS - 1;
+        a->stats.probes[bucket]++;
+    }
+    return last_node;
+}
+
+/**
+ * @brief Find a free block that is
  *  1. Freed
  *  2. Have a size bigger than the required size
  *  If find one -> return the header of the block.
  *  If can't find one -> return null (Call heap extension)
+ * The group that `asize` maps to is searched first: any block in it fits if
+ * it is an exact group, and it may hold blocks that are too small if not.
+ * Every block in a higher group is large enough, so the next candidate group
+ * is the lowest set bit of `list_bitmap` above it; empty groups are never
+ * visited. A request for a mini-block takes the first free
+ * mini-block, if there is one. Large requests, and any request that no list
+ * can serve, take the best fit from the size tree.
  * Pre -> None
  * Post -> The assigned block might be too big and required a split.
  *
+ * @param[in] a The arena to search
  * @param[in] asize The required size
  * @return The address of the found block
  */
-static block_t *find_fit(size_t asize) {
-    int i;
-    for (i = calculate_group(asize); i < group_count; i++) {
-        block_t *cur_node = list_start[i];
-        block_t *last_node = NULL;
-        int j = 0;
-        while (cur_node != NULL) {
-            if (!(get_alloc(cur_node)) && (asize <= get_size(cur_node))) {
-                j++;
-                if (last_node == NULL ||
-                    get_size(cur_node) < get_size(last_node)) {
-                    last_node = cur_node;
-                }
-            }
-            cur_node = cur_node->next;
-            if (j == 7) {
-                return last_node;
-            }
-        }
-        if (last_node != NULL) {
-            return last_node;
-        }
+static block_t *find_fit(arena_t *a, size_t asize) {
+    if (asize >= tree_min_size) {
+        return tree_find_fit(a, asize);
+    }
+    if (asize == min_block_size && a->mini_start != NULL) {
+        return a->mini_start;
+    }
+    int i = calculate_group(max(asize, min_group_size));
+    block_t *block = find_fit_in_list(a, i, asize);
+    if (block != NULL) {
+        return block;
     }
 
-    return NULL; // no fit found
-}
+    int w = i / 64;
+    word_t candidates = a->list_bitmap[w] & (~(word_t)1 << (i % 64));
+    while (candidates == 0 && ++w < GROUP_COUNT / 64) {
+        candidates = a->list_bitmap[w];
+    }
+    if (candidates == 0) {
+        return tree_find_fit(a, asize); // NULL if no fit is found
+    }
+    i = w * 64 + __builtin_ctzl(candidates);
+    return find_fit_in_list(a, i, asize);
+}
 
+#if MM_SLAB_MAX
 /**
- * @brief Check if the heap follow all the rule applied.
- * @param[in] line The line
+ * @brief Maps a request size to its slab class.
+ * @param[in] size A request size, `0 < size <= slab_max_size`
+ * @return The class, whose objects are the smallest multiple of 16 that
+ * holds `size` bytes
+ */
+static int slab_class(size_t size) {
+    dbg_requires(size > 0 && size <= slab_max_size);
+    return (int)((size - 1) / dsize);
+}
+
+/**
+ * @brief Finds the run that holds a slab object.
+ * @param[in] bp A slab object
+ * @return The run, which starts at the run-aligned address below `bp`
+ */
+static slab_run_t *slab_run_of(void *bp) {
+    return (slab_run_t *)((uintptr_t)bp & ~(uintptr_t)(slab_run_size - 1));
+}
+
+/**
+ * @brief Finds the first object of a run.
+ * @param[in] run A slab run
+ * @return The address just past the run header, rounded up to 16 bytes
+ */
+static char *slab_objects(slab_run_t *run) {
+    return (char *)run + round_up(sizeof(slab_run_t), dsize);
+}
+
+/**
+ * @brief Tells whether a payload was handed out by the slab layer.
+ * @param[in] bp A payload returned by malloc
+ * @return true if `bp` lies in a slab run
+ */
+static bool is_slab(void *bp) {
+#if MM_THREADS
+    // The bounds of other arenas may be changing, but the regions are fixed
+    return mem_region_of(bp) >= MM_ARENAS;
+#else
+    return (char *)bp >= arenas[0].slab_lo && (char *)bp < arenas[0].slab_hi;
+#endif
+}
+
+/**
+ * @brief Adds a run to the front of the partial list of its class.
+ * @param[in] a The arena that holds the run
+ * @param[in] run A run with at least one free object
+ */
+static void slab_link(arena_t *a, slab_run_t *run) {
+    int i = slab_class(run->size);
+    run->pre = NULL;
+    run->next = a->slab_partial[i];
+    if (run->next != NULL) {
+        run->next->pre = run;
+    }
+    a->slab_partial[i] = run;
+}
+
+/**
+ * @brief Removes a run from the partial list of its class.
+ * @param[in] a The arena that holds the run
+ * @param[in] run A run on its partial list
+ */
+static void slab_unlink(arena_t *a, slab_run_t *run) {
+    if (run->pre == NULL) {
+        a->slab_partial[slab_class(run->size)] = run->next;
+    } else {
+        run->pre->next = run->next;
+    }
+    if (run->next != NULL) {
+        run->next->pre = run->pre;
+    }
+}
+
+/**
+ * @brief Sets up a run for objects of one class and makes it the first
+ * partial run of that class. The run is taken from the empty list, or
+ * carved from the arena's slab region if that list is empty.
+ *
+ * @param[in] a The arena
+ * @param[in] i The slab class
+ * @return The run, or NULL if the slab region is exhausted
+ */
+static slab_run_t *slab_new_run(arena_t *a, int i) {
+    slab_run_t *run = a->slab_empty;
+    if (run != NULL) {
+        a->slab_empty = run->next;
+    } else {
+        void *p = mem_region_sbrk(a->region + MM_ARENAS, slab_run_size);
+        if (p == (void *)-1) {
+            return NULL;
+        }
+        run = p;
+        dbg_assert(slab_run_of(run) == run);
+        if (a->slab_lo == NULL) {
+            a->slab_lo = p;
+        }
+        a->slab_hi = (char *)p + slab_run_size;
+    }
+
+    size_t size = (size_t)(i + 1) * dsize;
+    size_t capacity =
+        (slab_run_size - (size_t)(slab_objects(run) - (char *)run)) / size;
+    run->size = (uint32_t)size;
+    run->capacity = (uint16_t)capacity;
+    run->free_count = (uint16_t)capacity;
+    // Objects past the capacity are marked as in use so they are never found
+    for (size_t w = 0; w < SLAB_MAP_WORDS; w++) {
+        size_t first = w * 64;
+        if (capacity >= first + 64) {
+            run->used[w] = 0;
+        } else if (capacity <= first) {
+            run->used[w] = ~(word_t)0;
+        } else {
+            run->used[w] = ~(word_t)0 << (capacity - first);
+        }
+    }
+    slab_link(a, run);
+    return run;
+}
+
+/**
+ * @brief Allocates an object from the first partial run of the request's
+ * class: the first clear bit of the occupancy bitmap names the object.
+ *
+ * @param[in] a The arena
+ * @param[in] size The size that the user requires, at most slab_max_size
+ * @return The object, or NULL if no run could be found or made
+ */
+static void *slab_malloc(arena_t *a, size_t size) {
+    int i = slab_class(size);
+    slab_run_t *run = a->slab_partial[i];
+    if (run == NULL && (run = slab_new_run(a, i)) == NULL) {
+        return NULL;
+    }
+
+    int w = 0;
+    while (run->used[w] == ~(word_t)0) {
+        w++;
+    }
+    int bit = __builtin_ctzl(~run->used[w]);
+    run->used[w] |= (word_t)1 << bit;
+    if (--run->free_count == 0) {
+        slab_unlink(a, run);
+    }
+    stats_count(&a->stats, run->size, true);
+    return slab_objects(run) + (size_t)(w * 64 + bit) * run->size;
+}
+
+/**
+ * @brief Frees a slab object by clearing its bit. A run that was full goes
+ * back on its partial list; a run that becomes empty moves to the empty
+ * list, unless it is the only partial run of its class.
+ *
+ * @param[in] a The arena that holds the object
+ * @param[in] bp The object
+ */
+static void slab_free(arena_t *a, void *bp) {
+    slab_run_t *run = slab_run_of(bp);
+    size_t index = (size_t)((char *)bp - slab_objects(run)) / run->size;
+    dbg_requires((run->used[index / 64] >> (index % 64)) & 1);
+
+    stats_count(&a->stats, run->size, false);
+    run->used[index / 64] &= ~((word_t)1 << (index % 64));
+    if (run->free_count++ == 0) {
+        slab_link(a, run);
+    } else if (run->free_count == run->capacity &&
+               (run->pre != NULL || run->next != NULL)) {
+        slab_unlink(a, run);
+        run->size = 0;
+        run->next = a->slab_empty;
+        a->slab_empty = run;
+    }
+}
+
+/**
+ * @brief Checks every slab run of an arena: the counts agree with the
+ * bitmaps, and each run is on the list that matches how full it is.
+ *
+ * @param[in] a The arena
  * @return false if any condition is not met
  */
-bool mm_checkheap(int line) {
+static bool check_slabs(arena_t *a) {
+    size_t partial_runs = 0;
+    size_t empty_runs = 0;
+    for (char *p = a->slab_lo; p < a->slab_hi; p += slab_run_size) {
+        slab_run_t *run = (slab_run_t *)p;
+        if (run->size == 0) {
+            empty_runs++;
+            continue;
+        }
+        if (run->size % dsize != 0 || run->size > slab_max_size ||
+            run->capacity != (slab_run_size - (size_t)(slab_objects(run) - p)) /
+                                 run->size) {
+            printf("slab run %p has a bad size\n", p);
+            return false;
+        }
+        size_t free_count = 0;
+        for (size_t k = 0; k < SLAB_MAP_WORDS * 64; k++) {
+            bool used = (run->used[k / 64] >> (k % 64)) & 1;
+            if (k >= run->capacity && !used) {
+                printf("slab run %p frees a missing object\n", p);
+                return false;
+            }
+            free_count += !used;
+        }
+        if (free_count != run->free_count) {
+            printf("slab run %p has a wrong free count\n", p);
+            return false;
+        }
+        partial_runs += free_count != 0;
+    }
+
+    // Every partial run is on the list of its class, and nothing else is
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        slab_run_t *pre = NULL;
+        for (slab_run_t *run = a->slab_partial[i]; run != NULL;
+             run = run->next) {
+            if ((char *)run < a->slab_lo || (char *)run >= a->slab_hi ||
+                slab_run_of(run) != run || run->size == 0 ||
+                slab_class(run->size) != i || run->free_count == 0 ||
+                run->pre != pre) {
+                printf("slab partial list %d is broken\n", i);
+                return false;
+            }
+            if (partial_runs-- == 0) {
+                printf("slab partial lists hold too many runs\n");
+                return false;
+            }
+            pre = run;
+        }
+    }
+    for (slab_run_t *run = a->slab_empty; run != NULL; run = run->next) {
+        if ((char *)run < a->slab_lo || (char *)run >= a->slab_hi ||
+            run->size != 0 || empty_runs-- == 0) {
+            printf("slab empty list is broken\n");
+            return false;
+        }
+    }
+    if (partial_runs != 0 || empty_runs != 0) {
+        printf("slab run missing from its list\n");
+        return false;
+    }
+    return true;
+}
+#endif /* MM_SLAB_MAX */
+
+/**
+ * @brief Finds the node that follows a node of the size tree in size order.
+ * @param[in] x A node
+ * @return The next larger node, or NULL
+ */
+static block_t *tree_successor(block_t *x) {
+    if (x->right != NULL) {
+        return tree_minimum(x->right);
+    }
+    while (x->parent != NULL && x == x->parent->right) {
+        x = x->parent;
+    }
+    return x->parent;
+}
+
+/**
+ * @brief Check the size tree of an arena: parent links agree with child
+ * links, node sizes increase from left to right and are all different, and
+ * the list of each node holds free blocks of its size.
+ * @param[in] a The arena
+ * @param[in] free_count The number of free blocks in the heap, which bounds
+ * the walk in case of a cycle
+ * @param[in,out] count Incremented for every block in the tree
+ * @return false if any condition is not met
+ */
+static bool check_tree(arena_t *a, size_t free_count, size_t *count) {
+    if (a->tree_root != NULL && a->tree_root->parent != NULL) {
+        printf("tree root has a parent\n");
+        return false;
+    }
+    size_t last_size = 0;
+    block_t *node = a->tree_root == NULL ? NULL : tree_minimum(a->tree_root);
+    while (node != NULL && *count <= free_count) {
+        size_t size = get_size(node);
+        if ((node->left != NULL && node->left->parent != node) ||
+            (node->right != NULL && node->right->parent != node) ||
+            node->pre != NULL || size <= last_size) {
+            printf("size tree is broken at %p\n", (void *)node);
+            return false;
+        }
+        block_t *pre = NULL;
+        for (block_t *b = node; b != NULL && *count <= free_count;
+             b = b->next) {
+            if (get_size(b) != size || get_alloc(b) || b->pre != pre ||
+                size < tree_min_size) {
+                printf("Wrong block in the size tree at %p\n", (void *)b);
+                return false;
+            }
+            (*count)++;
+            pre = b;
+        }
+        last_size = size;
+        node = tree_successor(node);
+    }
+    return true;
+}
+
+/**
+ * @brief Check if one arena follows all the rules applied.
+ * @param[in] a The arena, which must not be changed by another thread
+ * meanwhile
+ * @return false if any condition is not met
+ */
+static bool check_arena(arena_t *a) {
     // Check if the heap_start has been initialized
-    if (heap_start == NULL)
+    if (a->heap_start == NULL)
         return false;
-    block_t *cur_block = heap_start;
+    block_t *cur_block = a->heap_start;
     bool pre_alloc = true;
+    bool pre_mini = false;
     // Check the prologue
-    word_t *pro = find_prev_footer(heap_start);
+    word_t *pro = find_prev_footer(a->heap_start);
     if (extract_size(*pro) != 0 || !extract_alloc(*pro)) {
         printf("prologue wrong setting\n");
         return false;
     }
 
+    size_t free_count = 0;
+    size_t free_bytes = 0;
     while (get_size(cur_block) != 0) {
-        // Check if header and footer matching each other.
-        if (cur_block->header != *header_to_footer(cur_block)) {
-            printf("header footer mismatch\n");
+        // Check blocks lie within the arena's region.
+        if ((void *)cur_block > mem_region_hi(a->region) ||
+            (void *)cur_block < mem_region_lo(a->region)) {
+            printf("Seg fault\n");
             return false;
         }
-        cur_block = find_next(cur_block);
+
         // Check for the alignment of the payload
         if (round_up((size_t)header_to_payload(cur_block), dsize) !=
             (size_t)header_to_payload(cur_block)) {
@@ -720,22 +2053,35 @@ bool mm_checkheap(int line) {
             return false;
         }
 
-        // Check coalescing:  no consecutive free blocks in the heap.
-        if (!pre_alloc && get_alloc(cur_block)) {
-            printf("consecutive free\n");
+        // Check the pre_alloc bit agrees with the previous block
+        if (get_pre_alloc(cur_block) != pre_alloc) {
+            printf("pre_alloc bit mismatch\n");
             return false;
         }
-
-        // Check blocks lie within heap boundaries.
-        if ((void *)cur_block > mem_heap_hi() ||
-
-            (void *)cur_block < mem_heap_lo()) {
-            printf("Seg fault\n");
+        if (get_pre_mini(cur_block) != pre_mini) {
+            printf("pre_mini bit mismatch\n");
             return false;
         }
 
+        if (!get_alloc(cur_block)) {
+            // Only free blocks have a footer, and it must match the header.
+            if (get_size(cur_block) != min_block_size &&
+                cur_block->header != *header_to_footer(cur_block)) {
+                printf("header footer mismatch\n");
+                return false;
+            }
+            // Check coalescing:  no consecutive free blocks in the heap.
+            if (!pre_alloc) {
+                printf("consecutive free\n");
+                return false;
+            }
+            free_count++;
+            free_bytes += get_size(cur_block);
+        }
+
         // Store the alloc information of the current block
-        // pre_alloc = get_alloc(cur_block);
+        pre_alloc = get_alloc(cur_block);
+        pre_mini = get_size(cur_block) == min_block_size;
         cur_block = find_next(cur_block);
     }
 
@@ -744,16 +2090,22 @@ bool mm_checkheap(int line) {
         printf("epi not alloc\n");
         return false;
     }
+    if (get_pre_alloc(cur_block) != pre_alloc ||
+        get_pre_mini(cur_block) != pre_mini) {
+        printf("epilogue flags mismatch\n");
+        return false;
+    }
 
     // Check for circular LinkedList
     int i;
-    for (i = 0; i < 9; i++) {
-        block_t *slow_pointer = list_start[i];
-        block_t *fast_pointer = list_start[i];
+    for (i = 0; i < GROUP_COUNT; i++) {
+        block_t *slow_pointer = a->list_start[i];
+        block_t *fast_pointer = a->list_start[i];
         while (slow_pointer != NULL && fast_pointer != NULL &&
-               slow_pointer->next != NULL && fast_pointer->next != NULL) {
-            slow_pointer = slow_pointer->next;
-            fast_pointer = fast_pointer->next->next;
+               get_next(slow_pointer) != NULL &&
+               get_next(fast_pointer) != NULL) {
+            slow_pointer = get_next(slow_pointer);
+            fast_pointer = get_next(get_next(fast_pointer));
             if (slow_pointer == fast_pointer) {
                 printf("Circular list\n");
                 return false;
@@ -761,216 +2113,1838 @@ bool mm_checkheap(int line) {
         }
     }
     // Check if the ListNode is in the right group
-    for (i = 0; i < group_count; i++) {
-        block_t *pointer = list_start[i];
-        while (pointer != NULL && pointer->next != NULL) {
-            if (calculate_group(get_size(pointer)) != i) {
+    size_t list_count = 0;
+    for (i = 0; i < GROUP_COUNT; i++) {
+        block_t *pointer = a->list_start[i];
+        while (pointer != NULL) {
+            if (get_size(pointer) >= tree_min_size ||
+                calculate_group(get_size(pointer)) != i) {
                 printf("Wrong group of linkedlist\n");
                 return false;
             }
-            pointer = pointer->next;
+            if (list_group(pointer) != i) {
+                printf("Cached group of a block on list %d is wrong\n", i);
+                return false;
+            }
+            list_count++;
+            pointer = get_next(pointer);
+        }
+    }
+    if (!check_tree(a, free_count, &list_count)) {
+        return false;
+    }
+    // The mini-block list holds free mini-blocks only; stop early on a cycle
+    block_t *mini = a->mini_start;
+    while (mini != NULL && list_count <= free_count) {
+        if (get_size(mini) != min_block_size || get_alloc(mini)) {
+            printf("Wrong block on the mini-block list\n");
+            return false;
+        }
+        list_count++;
+        mini = get_next(mini);
+    }
+    // Every free block in the heap is on exactly one list
+    if (list_count != free_count) {
+        printf("free list count mismatch\n");
+        return false;
+    }
+    if (free_bytes != a->free_bytes) {
+        printf("free byte count mismatch\n");
+        return false;
+    }
+    // Check the bitmap agrees with which lists are empty
+    for (i = 0; i < GROUP_COUNT; i++) {
+        bool nonempty = (a->list_bitmap[i / 64] >> (i % 64)) & 1;
+        if (nonempty != (a->list_start[i] != NULL)) {
+            printf("Bitmap does not match list %d\n", i);
+            return false;
+        }
+    }
+#if MM_QUICK_MAX
+    // Quick lists hold allocated blocks of their own size; stop on a cycle
+    for (i = 0; i < MM_QUICK_MAX / 16; i++) {
+        int count = 0;
+        for (block_t *b = a->quick[i]; b != NULL && count <= MM_QUICK_LIMIT;
+             b = b->next) {
+            if ((void *)b > mem_region_hi(a->region) ||
+                (void *)b < mem_region_lo(a->region) || !get_alloc(b) ||
+                get_size(b) != (size_t)(i + 1) * dsize) {
+                printf("Wrong block on quick list %d\n", i);
+                return false;
+            }
+            count++;
+        }
+        if (count != a->quick_count[i]) {
+            printf("quick list %d count mismatch\n", i);
+            return false;
         }
     }
+#endif
 
+#if MM_SLAB_MAX
+    if (!check_slabs(a)) {
+        return false;
+    }
+#endif
     return true;
 }
 
 /**
- * @brief Initiate the heap by
- *  1. Getting a memory by sbrk(size of 2 word_t, one for prologue(size of 0 and
- * marked as allocated) the other as epilogue)
- *  2. extend the heap by a chunksize
- * Only when heap_start is null.
- * @return If the allocation of both start and heap extension succeed -> return
- * true Else -> return false
+ * @brief Check that a free block is linked into the list or tree that its
+ * size belongs to, as far as its own links and those of its neighbours in
+ * that list show, and that a block on a list records the right one.
+ * @param[in] a The arena that holds the block
+ * @param[in] block A free block
+ * @return false if any condition is not met
  */
-bool mm_init(void) {
-    // Create the initial empty heap
-    word_t *start = (word_t *)(mem_sbrk(2 * wsize));
-    if (start == (void *)-1) {
-        return false;
-    }
-    for (int i = 0; i < group_count; i++) {
-        list_start[i] = NULL;
+static bool check_links(arena_t *a, block_t *block) {
+    size_t size = get_size(block);
+    if (size >= tree_min_size) {
+        // Only a node of the size tree has no pre; the others hang off it
+        bool linked;
+        if (block->pre != NULL) {
+            linked = block->pre->next == block;
+        } else if (block->parent != NULL) {
+            linked = block->parent->left == block ||
+                     block->parent->right == block;
+        } else {
+            linked = a->tree_root == block;
+        }
+        return linked && (block->next == NULL || block->next->pre == block);
     }
-    /*
-     * TODO: delete or replace this comment once you've thought about it.
-     * Think about why we need a heap prologue and epilogue. Why do
-     * they correspond to a block footer and header respectively?
-     */
 
-    start[0] = pack(0, true); // Heap prologue (block footer)
-    start[1] = pack(0, true); // Heap epilogue (block header)
-    start[1] = start[1] |= pre_alloc_mask;
-    // Heap starts with first "block header", currently the epilogue
-    heap_start = (block_t *)&(start[1]);
-    // Extend the empty heap with a free block of chunksize bytes
-    if (extend_heap(chunksize) == NULL) {
+    block_t *head;
+    if (size == min_block_size) {
+        // The mini-block list has no back links to follow otherwise
+        if (!MM_COMPRESSED_LINKS) {
+            return true;
+        }
+        head = a->mini_start;
+    } else {
+        int i = calculate_group(size);
+        if (list_group(block) != i ||
+            !((a->list_bitmap[i / 64] >> (i % 64)) & 1)) {
+            return false;
+        }
+        head = a->list_start[i];
+    }
+    // The pre link of the head of a list is not kept up to date
+    block_t *next = get_next(block);
+    if (block != head &&
+        (get_pre(block) == NULL || get_next(get_pre(block)) != block)) {
         return false;
     }
-    return true;
+    return next == NULL || get_pre(next) == block;
 }
 
 /**
- * @brief
- * 1. Check if heap_start == NULL
- *    If true -> mm_init to initiate.
- * 2. If the required size == 0 return NULL
- * 3. Round up to make sure the size is a multiplication of 16 bytes, and find
- * blocks If the block is not found -> extend the heap and get the block's
- * pointer, if these is no more space -> Return NULL
- * 4. get the allocted block and write the header and the footer.
- * 5. Try to split the block if the block can be split
- * 6. Return the address of the payload
- *
- * @param[in] size The size that the user requires
- * @return The pointer to the payload for the user to write
+ * @brief Check one block of an arena without walking the heap: it lies in
+ * the arena's region with an aligned payload, the flags of the next block
+ * describe it, and if it is free, its footer matches, it has no free
+ * neighbour, and it is on the right free list.
+ * @param[in] a The arena that holds the block
+ * @param[in] block A block in the heap, or the epilogue
+ * @return false if any condition is not met
  */
-void *malloc(size_t size) {
-    dbg_requires(mm_checkheap(__LINE__));
-    size_t asize;      // Adjusted block size
-    size_t extendsize; // Amount to extend heap if no fit is found
-    block_t *block;
-    void *bp = NULL;
-
-    // Initialize heap if it isn't initialized
-    if (heap_start == NULL) {
-        mm_init();
+static bool check_block(arena_t *a, block_t *block) {
+    if ((void *)block > mem_region_hi(a->region) ||
+        (void *)block < mem_region_lo(a->region)) {
+        printf("block %p lies outside its arena\n", (void *)block);
+        return false;
     }
-
-    // Ignore spurious request
+    size_t size = get_size(block);
     if (size == 0) {
-        dbg_ensures(mm_checkheap(__LINE__));
-        return bp;
+        if (!get_alloc(block)) {
+            printf("epi not alloc\n");
+            return false;
+        }
+        return true;
+    }
+    if (round_up((size_t)header_to_payload(block), dsize) !=
+        (size_t)header_to_payload(block)) {
+        printf("payload not aligned\n");
+        return false;
+    }
+    block_t *next = find_next(block);
+    if ((void *)next > mem_region_hi(a->region)) {
+        printf("block %p runs past the end of its arena\n", (void *)block);
+        return false;
+    }
+    if (get_pre_alloc(next) != get_alloc(block) ||
+        get_pre_mini(next) != (size == min_block_size)) {
+        printf("flags after block %p mismatch\n", (void *)block);
+        return false;
+    }
+    if (get_alloc(block)) {
+        return true;
     }
 
-    // Adjust block size to include overhead and to meet alignment requirements
-    asize = max(round_up(size + wsize, dsize), min_block_size);
+    if (size != min_block_size && block->header != *header_to_footer(block)) {
+        printf("header footer mismatch\n");
+        return false;
+    }
+    if (!get_pre_alloc(block) || !get_alloc(next)) {
+        printf("consecutive free\n");
+        return false;
+    }
+    if (!check_links(a, block)) {
+        printf("free block %p is not on its list\n", (void *)block);
+        return false;
+    }
+    return true;
+}
 
-    // Search the free list for a fit
-    block = find_fit(asize);
-    // If no fit is found, request more memory, and then and place the block
+/**
+ * @brief The check for the start and end of every call that changes an
+ * arena. Walking the whole arena each time makes debug runs of large traces
+ * take hours, so only the block the call works on and its neighbours are
+ * checked, and the whole arena on every MM_CHECK_INTERVAL-th check.
+ * @param[in] a The arena, which must not be changed by another thread
+ * meanwhile
+ * @param[in] block The block that the call changed or is about to change, or
+ * NULL if there is none yet
+ * @return false if any condition is not met
+ */
+static bool check_near(arena_t *a, block_t *block) {
+    if (a->heap_start == NULL) {
+        return false;
+    }
+    if (++a->checks % MM_CHECK_INTERVAL == 0 && !check_arena(a)) {
+        return false;
+    }
     if (block == NULL) {
-        // Always request at least chunksize
-        extendsize = max(asize, chunksize);
-        block = extend_heap(extendsize);
-        // extend_heap returns an error
-        if (block == NULL) {
-            return bp;
+        return true;
+    }
+    if (!check_block(a, block)) {
+        return false;
+    }
+    // The previous block can only be found if it is free or a mini-block
+    if (!get_pre_alloc(block) || get_pre_mini(block)) {
+        block_t *prev = find_prev(block);
+        if (prev != NULL && !check_block(a, prev)) {
+            return false;
         }
     }
-    // The block should be marked as free
-    dbg_assert(!get_alloc(block));
-
-    // Mark block as allocated
-    size_t block_size = get_size(block);
-    // write_block(block, block_size, true);
-    bool pre_allocate = get_pre_alloc(block);
-    write_header(block, block_size, true);
-    write_pre_alloc(block, pre_allocate);
-    write_pre_alloc(find_next(block), true);
-
-    // Try to split the block if too large
-    remove_from_list(block);
-    split_block(block, asize);
-    bp = header_to_payload(block);
-
-    dbg_ensures(mm_checkheap(__LINE__));
-    return bp;
+    return get_size(block) == 0 || check_block(a, find_next(block));
 }
 
 /**
- * @brief Mark the block as freed and coalesce with the previous and next block.
- * The block must not be freed already.
- *
- * @param[in] bp A pointer that points to a starting point of a payload.
+ * @brief Check if the heap follow all the rule applied, in every arena that
+ * is in use. In the multi-threaded build no other thread may be using the
+ * allocator meanwhile.
+ * @param[in] line The line
+ * @return false if any condition is not met
  */
-void free(void *bp) {
-    dbg_requires(mm_checkheap(__LINE__));
-
-    if (bp == NULL) {
-        return;
+bool mm_checkheap(int line) {
+    if (arenas[0].heap_start == NULL) {
+        return false;
     }
+    for (int k = 0; k < MM_ARENAS; k++) {
+        if (arenas[k].heap_start != NULL && !check_arena(&arenas[k])) {
+            printf("arena %d is inconsistent (line %d)\n", k, line);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Adds the blocks of one arena's heap to a fragmentation report, in
+ * a single walk from the first block to the epilogue.
+ *
+ * @param[in,out] frag The report
+ * @param[in] a An arena in use
+ */
+static void frag_add_arena(struct mm_frag *frag, arena_t *a) {
+    for (block_t *block = a->heap_start; get_size(block) != 0;
+         block = find_next(block)) {
+        size_t size = get_size(block);
+        frag->heap_bytes += size;
+        if (get_alloc(block)) {
+            frag->alloc_blocks++;
+            frag->alloc_bytes += size;
+            continue;
+        }
+        frag->free_blocks++;
+        frag->free_bytes += size;
+        frag->largest_free = max(frag->largest_free, size);
+        int k = 63 - __builtin_clzl(size / dsize);
+        frag->size_hist[k < MM_FRAG_BUCKETS ? k : MM_FRAG_BUCKETS - 1]++;
+        if (size == min_block_size) {
+            frag->mini_blocks++;
+        } else if (size >= tree_min_size) {
+            frag->tree_blocks++;
+        } else {
+            frag->list_blocks[calculate_group(size)]++;
+        }
+    }
+#if MM_QUICK_MAX
+    for (int i = 0; i < MM_QUICK_MAX / 16; i++) {
+        frag->quick_blocks += a->quick_count[i];
+        frag->quick_bytes += (size_t)a->quick_count[i] * (i + 1) * 16;
+    }
+#endif
+}
+
+/**
+ * @brief Reports how the heap is split into allocated and free blocks, by
+ * walking every arena in use once: the largest free block, a histogram of
+ * free block sizes, the free blocks of each list, and the external
+ * fragmentation. A heap whose free bytes are spread over many small blocks
+ * cannot serve a large request without growing, however many bytes are
+ * free, and that is what keeps utilization down.
+ *
+ * As with mm_checkheap, no other thread may use the allocator meanwhile.
+ *
+ * @param[out] frag Receives the report
+ * @return false if the heap has not been initialized
+ */
+bool mm_fragmentation(struct mm_frag *frag) {
+    *frag = (struct mm_frag){0};
+    if (arenas[0].heap_start == NULL) {
+        return false;
+    }
+    for (int k = 0; k < MM_ARENAS; k++) {
+        if (arenas[k].heap_start != NULL) {
+            frag_add_arena(frag, &arenas[k]);
+        }
+    }
+    if (frag->free_bytes != 0) {
+        frag->external =
+            1.0 - (double)frag->largest_free / (double)frag->free_bytes;
+    }
+    return true;
+}
+
+/**
+ * @brief Initiate the heap of one arena by
+ *  1. Getting a memory by sbrk(size of 2 word_t, one for prologue(size of 0 and
+ * marked as allocated) the other as epilogue)
+ *  2. extend the heap by a chunksize
+ * @param[in] a An arena whose heap has not been created yet
+ * @return If the allocation of both start and heap extension succeed -> return
+ * true Else -> return false
+ */
+static bool arena_init(arena_t *a) {
+    a->region = (int)(a - arenas);
+#if MM_THREADS
+    // No block of this arena exists yet, so nobody can be pushing to it
+    a->remote_stub.next = NULL;
+    a->remote_head = &a->remote_stub;
+    a->remote_tail = &a->remote_stub;
+#endif
+    a->clean = mem_region_lo(a->region);
+    // Create the initial empty heap
+    word_t *start = (word_t *)(mem_region_sbrk(a->region, 2 * wsize));
+    if (start == (void *)-1) {
+        return false;
+    }
+    for (int i = 0; i < GROUP_COUNT; i++) {
+        a->list_start[i] = NULL;
+    }
+    for (int i = 0; i < GROUP_COUNT / 64; i++) {
+        a->list_bitmap[i] = 0;
+    }
+    a->mini_start = NULL;
+    a->tree_root = NULL;
+    a->free_bytes = 0;
+    a->stats = (struct mm_stats){0};
+    a->checks = 0;
+#if MM_QUICK_MAX
+    for (int i = 0; i < MM_QUICK_MAX / 16; i++) {
+        a->quick[i] = NULL;
+        a->quick_count[i] = 0;
+    }
+#endif
+#if MM_SLAB_MAX
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        a->slab_partial[i] = NULL;
+    }
+    a->slab_empty = NULL;
+    a->slab_lo = NULL;
+    a->slab_hi = NULL;
+#endif
+    /*
+     * The prologue looks like the footer of an allocated block, and the
+     * epilogue like the header of an allocated block of size 0, so that
+     * coalescing never runs past either end of the heap. The epilogue also
+     * records that the block before it, the prologue, is allocated.
+     */
+    start[0] = pack(0, true);                  // Heap prologue (block footer)
+    start[1] = pack(0, true) | pre_alloc_mask; // Heap epilogue (block header)
+    // Heap starts with first "block header", currently the epilogue
+    a->heap_start = (block_t *)&(start[1]);
+    // Extend the empty heap with a free block of chunksize bytes
+    if (extend_heap(a, chunksize) == NULL) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Initiate the heap: arena 0 is created right away, and every other
+ * arena when a thread first allocates from it.
+ * In the multi-threaded build no other thread may be using the allocator
+ * while the heap is being initialized.
+ * With compressed links, the heap must be aligned and every arena's memlib
+ * region must start within link_range of mem_heap_lo(), or mm_init fails.
+ * @return If the allocation of both start and heap extension succeed -> return
+ * true Else -> return false
+ */
+bool mm_init(void) {
+    for (int k = 0; k < MM_ARENAS; k++) {
+        arenas[k].heap_start = NULL;
+    }
+#if MM_COMPRESSED_LINKS
+    link_base = mem_heap_lo();
+    if ((size_t)link_base % dsize != 0) {
+        return false;
+    }
+    for (int k = 0; k < MM_ARENAS; k++) {
+        char *lo = mem_region_lo(k);
+        if (lo < link_base || (size_t)(lo - link_base) >= link_range) {
+            return false;
+        }
+    }
+#endif
+#if MM_THREADS
+    heap_generation++;
+    mapped_stats = (struct mm_stats){0};
+#endif
+    return arena_init(&arenas[0]);
+}
+
+#if MM_TRIM_THRESHOLD
+/**
+ * @brief Shrink the arena's region if a free block at its end is larger than
+ * MM_TRIM_THRESHOLD, leaving the block with chunksize bytes.
+ *
+ * @param[in] a The arena that holds the block
+ * @param[in] block A coalesced free block that is on no list
+ */
+static void trim_heap(arena_t *a, block_t *block) {
+    dbg_requires(!get_alloc(block));
+    size_t size = get_size(block);
+    block_t *epilogue = find_next(block);
+
+    if (get_size(epilogue) != 0 || size <= MM_TRIM_THRESHOLD) {
+        return;
+    }
+    if (mem_region_trim(a->region, size - chunksize) == (void *)-1) {
+        return;
+    }
+    write_block(block, chunksize, false);
+    write_epilogue(find_next(block));
+}
+#endif
+
+/**
+ * @brief Frees a run of adjacent allocated blocks as one free block, and
+ * coalesces it with the previous and next block. If that leaves a large free
+ * block at the end of the arena, the heap is trimmed.
+ *
+ * @param[in] a The arena that holds the blocks
+ * @param[in] block The first block of the run
+ * @param[in] size The total size of the blocks in the run
+ * @return The free block that the run became part of
+ */
+static block_t *free_run(arena_t *a, block_t *block, size_t size) {
+    // The block should be marked as allocated
+    dbg_assert(get_alloc(block));
+
+    // Mark the block as free
+    bool merged = size != get_size(block);
+    write_block(block, size, false);
+    write_pre_alloc(find_next(block), false);
+    if (merged) {
+        // A merged block is never a mini-block
+        write_pre_mini(find_next(block), false);
+    }
+    // Try to coalesce the block with its neighbors
+    block = coalesce_block(a, block);
+#if MM_TRIM_THRESHOLD
+    trim_heap(a, block);
+#endif
+    add_to_first(a, block);
+    return block;
+}
+
+#if MM_QUICK_MAX
+/**
+ * @brief Merges a chain of blocks from a quick list into the free lists,
+ * the same way heap_free would have when they were freed.
+ * @param[in] a The arena that holds the blocks
+ * @param[in] block The first block of the chain, or NULL
+ */
+static void quick_merge(arena_t *a, block_t *block) {
+    while (block != NULL) {
+        block_t *next = block->next;
+        free_run(a, block, get_size(block));
+        block = next;
+    }
+}
+
+/**
+ * @brief Merges the blocks on every quick list of an arena into the free
+ * lists.
+ * @param[in] a The arena
+ * @return true if there were any
+ */
+static bool quick_flush(arena_t *a) {
+    bool merged = false;
+    for (int i = 0; i < MM_QUICK_MAX / 16; i++) {
+        if (a->quick[i] != NULL) {
+            quick_merge(a, a->quick[i]);
+            a->quick[i] = NULL;
+            a->quick_count[i] = 0;
+            merged = true;
+        }
+    }
+    return merged;
+}
+
+/**
+ * @brief Puts a block that is being freed on the quick list of its size,
+ * without coalescing it; it stays marked as allocated. If the list then
+ * holds more than MM_QUICK_LIMIT blocks, all but this one are merged.
+ * @param[in] a The arena that holds the block
+ * @param[in] block An allocated block
+ * @param[in] size The size of the block
+ * @return false if the block is too large for the quick lists, and must be
+ * freed at once
+ */
+static bool quick_push(arena_t *a, block_t *block, size_t size) {
+    dbg_requires(get_size(block) == size);
+    if (size > MM_QUICK_MAX) {
+        return false;
+    }
+    int i = (int)(size / dsize) - 1;
+    block->next = a->quick[i];
+    a->quick[i] = block;
+    if (++a->quick_count[i] > MM_QUICK_LIMIT) {
+        quick_merge(a, block->next);
+        block->next = NULL;
+        a->quick_count[i] = 1;
+    }
+    return true;
+}
+
+/**
+ * @brief Takes the block freed last of a given size off its quick list.
+ * @param[in] a The arena
+ * @param[in] asize The adjusted block size that is needed
+ * @return A block of exactly `asize` bytes, still marked as allocated, or
+ * NULL if there is none
+ */
+static block_t *quick_pop(arena_t *a, size_t asize) {
+    if (asize > MM_QUICK_MAX) {
+        return NULL;
+    }
+    int i = (int)(asize / dsize) - 1;
+    block_t *block = a->quick[i];
+    if (block != NULL) {
+        a->quick[i] = block->next;
+        a->quick_count[i]--;
+    }
+    return block;
+}
+#endif
+
+/**
+ * @brief Returns the least number of bytes to extend an arena by: a share
+ * of the heap's size, up to grow_max, or chunksize while the arena's free
+ * blocks already add up to that share. A heap with that much free memory
+ * is fragmented, and would waste most of a larger extension too.
+ *
+ * @param[in] a The arena
+ * @return The extension size, a multiple of chunksize
+ */
+static size_t grow_step(arena_t *a) {
+    if (grow_shift == 0) {
+        return chunksize;
+    }
+    size_t heap_size = (char *)mem_region_hi(a->region) + 1 -
+                       (char *)mem_region_lo(a->region);
+    size_t step = heap_size >> grow_shift;
+    if (a->free_bytes >= step) {
+        return chunksize;
+    }
+    step = step < grow_max ? step : grow_max;
+    return max(round_up(step, chunksize), chunksize);
+}
+
+/**
+ * @brief Extends the heap so that the free block at its end holds at least
+ * `asize` bytes. It always requests at least grow_step, and nothing that a
+ * free block at the end of the heap, with which the new one will coalesce,
+ * already provides. The quick lists are merged first, and the heap is not
+ * extended if that yields a block that fits.
+ *
+ * @param[in] a The arena
+ * @param[in] asize The adjusted block size that is needed
+ * @return A free block of at least `asize` bytes, or NULL on error
+ */
+static block_t *grow_heap(arena_t *a, size_t asize) {
+#if MM_QUICK_MAX
+    // Merging the quick lists may make a block that fits
+    if (quick_flush(a)) {
+        block_t *block = find_fit(a, asize);
+        if (block != NULL) {
+            return block;
+        }
+    }
+#endif
+    size_t extendsize = asize;
+    block_t *epilogue =
+        (block_t *)((char *)mem_region_hi(a->region) - wsize + 1);
+    if (!get_pre_alloc(epilogue)) {
+        extendsize -= get_size(find_prev(epilogue));
+    }
+    extendsize = max(extendsize, grow_step(a));
+    return extend_heap(a, extendsize);
+}
+
+/**
+ * @brief Sets the first bytes of a block just taken off the free lists to
+ * zero. Memory at or above the arena's clean mark already reads as zero,
+ * apart from the links and footer the block carried while it was free.
+ *
+ * @param[in] a The arena that holds the block
+ * @param[in] block The block, before it is marked as used
+ * @param[in] size The number of payload bytes to clear
+ */
+static void clear_payload(arena_t *a, block_t *block, size_t size) {
+    char *bp = header_to_payload(block);
+    char *end = bp + size;
+    char *dirty = bp + (sizeof(block_t) - offsetof(block_t, payload));
+    if (a->clean > dirty) {
+        dirty = a->clean;
+    }
+    if (!mem_zeroed() || dirty >= end) {
+        memset(bp, 0, size);
+        return;
+    }
+    memset(bp, 0, dirty - bp);
+    char *footer = (char *)find_next(block) - wsize;
+    if (footer < end) {
+        memset(footer, 0, end - footer);
+    }
+}
+
+/**
+ * @brief
+ * 1. Check if heap_start == NULL
+ *    If true -> mm_init to initiate.
+ * 2. If the required size == 0 return NULL
+ * 3. Round up to make sure the size is a multiplication of 16 bytes, and find
+ * blocks If the block is not found -> extend the heap and get the block's
+ * pointer, if these is no more space -> Return NULL
+ * 4. get the allocted block and write the header and the footer.
+ * 5. Try to split the block if the block can be split
+ * 6. Clear the payload if asked to, and return its address
+ *
+ * @param[in] a The arena to allocate from
+ * @param[in] size The size that the user requires
+ * @param[in] zero Whether the payload must read as zero
+ * @return The pointer to the payload for the user to write
+ */
+static void *heap_malloc(arena_t *a, size_t size, bool zero) {
+    size_t asize; // Adjusted block size
+    block_t *block;
+    void *bp = NULL;
+
+    // Initialize heap if it isn't initialized
+    if (a->heap_start == NULL) {
+        if (!arena_init(a)) {
+            return bp;
+        }
+    }
+    dbg_requires(check_near(a, NULL));
+
+    // Ignore spurious request
+    if (size == 0) {
+        return bp;
+    }
+
+    // Refuse a request whose block size would not fit in a size_t
+    if (size > SIZE_MAX - dsize - wsize) {
+        return bp;
+    }
+
+    // Adjust block size to include overhead and to meet alignment requirements
+    asize = max(round_up(size + wsize, dsize), min_block_size);
+
+#if MM_QUICK_MAX
+    // A block freed lately is still allocated, and needs no split
+    block = quick_pop(a, asize);
+    if (block != NULL) {
+        if (zero) {
+            clear_payload(a, block, size);
+        }
+        stats_count(&a->stats, get_payload_size(block), true);
+        dbg_ensures(check_near(a, block));
+        return header_to_payload(block);
+    }
+#endif
+
+    // Search the free list for a fit
+    block = find_fit(a, asize);
+    // If no fit is found, request more memory, and then and place the block
+    if (block == NULL) {
+        block = grow_heap(a, asize);
+        // extend_heap returns an error
+        if (block == NULL) {
+            return bp;
+        }
+    }
+    // The block should be marked as free
+    dbg_assert(!get_alloc(block));
+
+    // Mark block as allocated
+    size_t block_size = get_size(block);
+    write_header(block, block_size, true);
+    write_pre_alloc(find_next(block), true);
+
+    // Try to split the block if too large
+    remove_from_list(a, block);
+    split_block(a, block, asize);
+    if (zero) {
+        clear_payload(a, block, size);
+    }
+    mark_dirty(a, find_next(block));
+    stats_count(&a->stats, get_payload_size(block), true);
+    bp = header_to_payload(block);
+
+    dbg_ensures(check_near(a, block));
+    return bp;
+}
+
+/**
+ * @brief Allocates up to `n` adjacent blocks of `asize` bytes from a free
+ * block, which the last of them shares with whatever is split off.
+ *
+ * @param[in] a The arena that holds the block
+ * @param[in] block A free block of at least `asize` bytes
+ * @param[in] asize The adjusted size of every block
+ * @param[in] n The number of blocks wanted
+ * @param[out] ptrs Receives the payload of each block
+ * @return The number of blocks carved, at least 1 and at most `n`
+ */
+static size_t carve_blocks(arena_t *a, block_t *block, size_t asize,
+                           size_t n, void **ptrs) {
+    dbg_requires(!get_alloc(block));
+    size_t block_size = get_size(block);
+    n = block_size / asize < n ? block_size / asize : n;
+
+    remove_from_list(a, block);
+    write_pre_alloc(find_next(block), true);
+    // Every block but the first follows an allocated block of asize bytes
+    word_t flags = pre_alloc_mask;
+    if (asize == min_block_size) {
+        flags |= pre_mini_mask;
+    }
+    for (size_t k = 0; k < n - 1; k++) {
+        write_header(block, asize, true);
+        ptrs[k] = header_to_payload(block);
+        stats_count(&a->stats, asize - wsize, true);
+        block = find_next(block);
+        block->header = flags;
+    }
+    // The last block takes the rest, and gives back what it does not need
+    write_header(block, block_size - (n - 1) * asize, true);
+    ptrs[n - 1] = header_to_payload(block);
+    split_block(a, block, asize);
+    write_pre_mini(find_next(block), get_size(block) == min_block_size);
+    mark_dirty(a, find_next(block));
+    stats_count(&a->stats, get_payload_size(block), true);
+    return n;
+}
+
+/**
+ * @brief Allocates up to `n` blocks of the same size at once. Each search
+ * of the free lists yields as many blocks as the free block it finds can
+ * hold, and the heap is extended at most once, to fit all that remain.
+ *
+ * @param[in] a The arena to allocate from
+ * @param[in] size The size of every block
+ * @param[in] n The number of blocks wanted
+ * @param[out] ptrs Receives the payload of each block
+ * @return The number of blocks allocated, less than `n` only on error
+ */
+static size_t heap_malloc_batch(arena_t *a, size_t size, size_t n,
+                                void **ptrs) {
+    if (a->heap_start == NULL && !arena_init(a)) {
+        return 0;
+    }
+    if (size == 0 || size > SIZE_MAX - dsize - wsize) {
+        return 0;
+    }
+    dbg_requires(check_near(a, NULL));
+
+    size_t asize = max(round_up(size + wsize, dsize), min_block_size);
+    size_t k = 0;
+    while (k < n) {
+        // Fill the holes that a single malloc would use before the heap
+        block_t *block = find_fit(a, asize);
+        if (block == NULL) {
+            size_t want = n - k < (SIZE_MAX / 2) / asize ? n - k : 1;
+            if ((block = grow_heap(a, asize * want)) == NULL &&
+                (want == 1 || (block = grow_heap(a, asize)) == NULL)) {
+                break;
+            }
+        }
+        size_t first = k;
+        k += carve_blocks(a, block, asize, n - k, ptrs + k);
+        // The blocks in between are only next to blocks of the same run
+        dbg_assert(check_near(a, payload_to_header(ptrs[first])));
+        dbg_assert(check_near(a, payload_to_header(ptrs[k - 1])));
+    }
+    return k;
+}
+
+/**
+ * @brief Returns how many bytes at the start of a free block to skip, so
+ * that the payload of the block after them is aligned. A mini-block is
+ * never skipped, since taking one off its list again means a linear search.
+ *
+ * @param[in] block A free block
+ * @param[in] align The alignment, a power of 2 greater than dsize
+ * @return The number of bytes to skip, 0 or at least 2 * dsize
+ */
+static size_t aligned_lead(block_t *block, size_t align) {
+    uintptr_t bp = (uintptr_t)header_to_payload(block);
+    size_t lead = round_up(bp, align) - bp;
+    return lead == min_block_size ? lead + align : lead;
+}
+
+/**
+ * @brief Allocates a heap block whose payload is aligned to `align` bytes.
+ * The free block found has room for the payload where it falls; what lies
+ * before the aligned payload and what it does not need after it are split
+ * off as free blocks.
+ *
+ * @param[in] a The arena to allocate from
+ * @param[in] align The alignment, a power of 2 greater than dsize
+ * @param[in] size The size that the user requires
+ * @return The pointer to the payload for the user to write, or NULL
+ */
+static void *heap_memalign(arena_t *a, size_t align, size_t size) {
+    dbg_requires(align > dsize && (align & (align - 1)) == 0);
+    if (a->heap_start == NULL && !arena_init(a)) {
+        return NULL;
+    }
+    if (size == 0 || size > SIZE_MAX - 2 * align - dsize) {
+        return NULL;
+    }
+    dbg_requires(check_near(a, NULL));
+
+    // Payloads are dsize aligned, so at most align - dsize bytes are skipped,
+    // or align + min_block_size to get past a mini-block
+    size_t asize = max(round_up(size + wsize, dsize), min_block_size);
+    block_t *block = find_fit(a, asize + align - dsize);
+    if (block != NULL && get_size(block) < aligned_lead(block, align) + asize) {
+        block = find_fit(a, asize + 2 * align - dsize);
+    }
+    if (block == NULL) {
+        block = grow_heap(a, asize + 2 * align - dsize);
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+    dbg_assert(!get_alloc(block));
+
+    size_t block_size = get_size(block);
+    size_t lead = aligned_lead(block, align);
+    dbg_assert(block_size >= lead + asize);
+    remove_from_list(a, block);
+    if (lead != 0) {
+        // The skipped bytes stay free, as a block too large to be a mini-block
+        dbg_assert(lead != min_block_size);
+        write_block(block, lead, false);
+        add_to_first(a, block);
+        block = (block_t *)((char *)block + lead);
+        block->header = 0;
+    }
+    write_header(block, block_size - lead, true);
+    write_pre_alloc(find_next(block), true);
+    write_pre_mini(find_next(block), block_size - lead == min_block_size);
+    // Even a mini-block is split off the end, so that the block has the size
+    // that mm_free_sized computes from the request
+    split_block(a, block, asize);
+    mark_dirty(a, find_next(block));
+    stats_count(&a->stats, get_payload_size(block), true);
+
+    dbg_ensures((uintptr_t)header_to_payload(block) % align == 0);
+    dbg_ensures(check_near(a, block));
+    return header_to_payload(block);
+}
+
+/**
+ * @brief Mark the block as freed and coalesce with the previous and next block.
+ * If that leaves a large free block at the end of the arena, the heap is
+ * trimmed. A small block goes on a quick list instead, if there are any. The
+ * block must not be freed already.
+ *
+ * @param[in] a The arena that holds the block
+ * @param[in] bp A pointer that points to a starting point of a payload.
+ */
+static void heap_free(arena_t *a, void *bp) {
+    if (bp == NULL) {
+        return;
+    }
+
+    block_t *block = payload_to_header(bp);
+    dbg_requires(check_near(a, block));
+    stats_count(&a->stats, get_payload_size(block), false);
+#if MM_QUICK_MAX
+    if (quick_push(a, block, get_size(block))) {
+        dbg_ensures(check_near(a, block));
+        return;
+    }
+#endif
+    block = free_run(a, block, get_size(block));
+    dbg_ensures(check_near(a, block));
+}
+
+/**
+ * @brief Try to resize an allocated block without moving it.
+ *  1. If the block is already big enough, shrink it by splitting off the
+ * unused tail (merged with the next block first if that one is free).
+ *  2. If the block plus a free next block is big enough, grow into it.
+ *  3. If the block is the last one in the heap, possibly followed by a free
+ * block, extend the heap by just the missing bytes and grow into them.
+ *
+ * @param[in] a The arena that holds the block
+ * @param[in] block The allocated block to resize
+ * @param[in] asize The adjusted block size that is needed
+ * @return true if the block now holds at least `asize` bytes, false if it
+ * has to be moved (the block is left untouched in that case)
+ */
+static bool resize_in_place(arena_t *a, block_t *block, size_t asize) {
+    dbg_requires(get_alloc(block));
+    block_t *block_next = find_next(block);
+    size_t avail = get_size(block);
+
+    if (!get_alloc(block_next)) {
+        avail += get_size(block_next);
+        block_next = find_next(block_next);
+    }
+
+    if (avail < asize) {
+        // Only the tail of the heap can grow without moving
+        if (get_size(block_next) != 0) {
+            return false;
+        }
+        if (extend_heap(a, max(asize - avail, min_block_size)) == NULL) {
+            return false;
+        }
+    }
+
+    size_t old_usable = get_payload_size(block);
+    if (!get_alloc(find_next(block))) {
+        absorb_next(a, block);
+    }
+    split_block(a, block, asize);
+    mark_dirty(a, find_next(block));
+    stats_resize(&a->stats, old_usable, get_payload_size(block));
+    return true;
+}
+
+/**
+ * @brief Reallocate the size of a allocated block.
+ *  1. If the required size is 0 -> Same as freeing the block.
+ *  2. If the ptr points to a null space, return the generic pointer generated
+ * by malloc.
+ *  3. If the block can be shrunk or grown where it is, return the original
+ * pointer without copying.
+ *  4. If the malloc fails, return null and the original block is left
+ * untouched.
+ *  5. if the malloc is successful, copy the payload to the new allocated heap
+ * and freed the original heap.
+ *
+ * @param[in] a The arena that holds the block, where any new block is
+ * allocated as well
+ * @param[in] ptr A generic pointer that needs to be reallocated.
+ * @param[in] size The size of the newly requested block.
+ * @return The original pointer and the size that the user wants to re-allocate.
+ */
+static void *heap_realloc(arena_t *a, void *ptr, size_t size) {
+
+    block_t *block = payload_to_header(ptr);
+    size_t copysize;
+    void *newptr;
+
+    // If size == 0, then free block and return NULL
+    if (size == 0) {
+        heap_free(a, ptr);
+        return NULL;
+    }
+
+    // If ptr is NULL, then equivalent to malloc
+    if (ptr == NULL) {
+        return heap_malloc(a, size, false);
+    }
+
+    // If the block size would not fit in a size_t, leave the block alone
+    if (size > SIZE_MAX - dsize - wsize) {
+        return NULL;
+    }
+
+    dbg_requires(check_near(a, block));
+
+    // Grow or shrink in place when the neighbouring space allows it
+    size_t asize = max(round_up(size + wsize, dsize), min_block_size);
+    if (resize_in_place(a, block, asize)) {
+        dbg_ensures(check_near(a, block));
+        return ptr;
+    }
+
+    // Otherwise, proceed with reallocation
+    newptr = heap_malloc(a, size, false);
+
+    // If malloc fails, the original block is left untouched
+    if (newptr == NULL) {
+        return NULL;
+    }
+
+    // Copy the old data
+    copysize = get_payload_size(block); // gets size of old payload
+    if (size < copysize) {
+        copysize = size;
+    }
+
+    memcpy(newptr, ptr, copysize);
+
+    // Free the old block
+    heap_free(a, ptr);
+
+    return newptr;
+}
+
+#if MM_MAP_THRESHOLD
+/**
+ * @brief Returns whether an allocated block has a mapping of its own.
+ * @param[in] block An allocated block
+ * @return true if the block was allocated by huge_malloc
+ */
+static bool is_mapped(block_t *block) {
+#if MM_THREADS
+    // A heap block's header may be rewritten by a neighbour at the same time
+    return __atomic_load_n(&block->header, __ATOMIC_RELAXED) & mapped_mask;
+#else
+    return block->header & mapped_mask;
+#endif
+}
+
+/**
+ * @brief Returns how far into its mapping a block allocated by huge_malloc
+ * starts. The word before the header holds this offset.
+ *
+ * @param[in] block A block allocated by huge_malloc
+ * @return The number of bytes of the mapping before the header
+ */
+static size_t huge_padding(block_t *block) {
+    return *((word_t *)block - 1);
+}
+
+/**
+ * @brief Allocates a block in a mapping of its own. The mapping starts with
+ * padding, so that the payload is aligned, and the block covers the rest of
+ * it except for the last word. The last word of the padding records its
+ * length.
+ *
+ * @param[in] size The size that the user requires
+ * @param[in] align The alignment of the payload, a power of 2 no less than
+ * dsize
+ * @return The pointer to the payload for the user to write, or NULL
+ */
+static void *huge_malloc(size_t size, size_t align) {
+    size_t page = mem_pagesize();
+    if (size > SIZE_MAX - page - align - wsize) {
+        return NULL;
+    }
+    // The mapping is page aligned, so the payload is at most align bytes in
+    size_t len = round_up(size + align + wsize, page);
+    char *base = mem_map(len);
+    if (base == (void *)-1) {
+        return NULL;
+    }
+    char *bp = (char *)round_up((uintptr_t)base + dsize, align);
+    block_t *block = payload_to_header(bp);
+    *((word_t *)block - 1) = (char *)block - base;
+    block->header = pack(base + len - wsize - (char *)block, true) |
+                    mapped_mask;
+    stats_count_mapped(get_payload_size(block), true);
+    return bp;
+}
+
+/**
+ * @brief Releases the mapping of a block allocated by huge_malloc.
+ * @param[in] block The block
+ */
+static void huge_free(block_t *block) {
+    dbg_requires(is_mapped(block));
+    size_t pad = huge_padding(block);
+    stats_count_mapped(get_payload_size(block), false);
+    mem_unmap((char *)block - pad, pad + get_size(block) + wsize);
+}
+
+#endif
+
+/**
+ * @brief Finds the arena that holds a block or slab object.
+ * @param[in] block A block allocated from some arena
+ * @return The arena whose memlib regions contain the block
+ */
+static arena_t *arena_of(block_t *block) {
+#if MM_ARENAS > 1
+    return &arenas[mem_region_of(block) % MM_ARENAS];
+#else
+    return &arenas[0];
+#endif
+}
+
+/**
+ * @brief Allocates from an arena: small requests come from a slab run if
+ * possible, huge ones get a mapping of their own if memlib has room for it,
+ * and everything else comes from the heap.
+ *
+ * @param[in] a The arena
+ * @param[in] size The size that the user requires
+ * @return The pointer to the payload for the user to write, or NULL
+ */
+static void *arena_malloc(arena_t *a, size_t size) {
+#if MM_MAP_THRESHOLD
+    if (size >= MM_MAP_THRESHOLD) {
+        // mem_map fails once the heap has grown into the room for mappings
+        void *bp = huge_malloc(size, dsize);
+        if (bp != NULL) {
+            return bp;
+        }
+    }
+#endif
+#if MM_SLAB_MAX
+    if (size != 0 && size <= slab_max_size) {
+        void *bp = slab_malloc(a, size);
+        if (bp != NULL) {
+            return bp;
+        }
+    }
+#endif
+    return heap_malloc(a, size, false);
+}
+
+/**
+ * @brief Frees a payload into the arena that holds it.
+ * @param[in] a The arena that holds the payload
+ * @param[in] bp A payload returned by arena_malloc, or NULL
+ */
+static void arena_free(arena_t *a, void *bp) {
+#if MM_SLAB_MAX
+    if (bp != NULL && is_slab(bp)) {
+        slab_free(a, bp);
+        return;
+    }
+#endif
+#if MM_MAP_THRESHOLD
+    if (bp != NULL && is_mapped(payload_to_header(bp))) {
+        huge_free(payload_to_header(bp));
+        return;
+    }
+#endif
+    heap_free(a, bp);
+}
+
+/**
+ * @brief Frees a payload into the arena that holds it, given the size last
+ * requested for it. A heap block has the size that heap_malloc makes for
+ * such a request, so a small one goes on its quick list without its header
+ * being read; only a size that might be a slab object or a mapped block
+ * is checked further.
+ *
+ * @param[in] a The arena that holds the payload
+ * @param[in] bp A payload returned by arena_malloc, arena_calloc,
+ * arena_realloc or arena_memalign
+ * @param[in] size The size last requested for the payload
+ */
+static void arena_free_sized(arena_t *a, void *bp, size_t size) {
+#if MM_SLAB_MAX
+    if (size <= slab_max_size && is_slab(bp)) {
+        slab_free(a, bp);
+        return;
+    }
+#endif
+#if MM_MAP_THRESHOLD
+    // The heap serves such requests too when mem_map has no room
+    if (size >= MM_MAP_THRESHOLD) {
+        arena_free(a, bp);
+        return;
+    }
+#endif
+#if MM_QUICK_MAX
+    size_t asize = max(round_up(size + wsize, dsize), min_block_size);
+    block_t *block = payload_to_header(bp);
+    dbg_requires(check_near(a, block));
+    if (quick_push(a, block, asize)) {
+        stats_count(&a->stats, asize - wsize, false);
+        dbg_ensures(check_near(a, block));
+        return;
+    }
+#endif
+    heap_free(a, bp);
+}
+
+/**
+ * @brief Allocates `n` payloads of the same size from an arena. Heap blocks
+ * are carved from one free block; slab objects and mapped blocks are
+ * allocated one by one.
+ *
+ * @param[in] a The arena
+ * @param[in] size The size of every payload
+ * @param[in] n The number of payloads wanted
+ * @param[out] ptrs Receives the payloads
+ * @return The number of payloads allocated
+ */
+static size_t arena_malloc_batch(arena_t *a, size_t size, size_t n,
+                                 void **ptrs) {
+    bool one_by_one = false;
+#if MM_MAP_THRESHOLD
+    one_by_one = one_by_one || size >= MM_MAP_THRESHOLD;
+#endif
+#if MM_SLAB_MAX
+    one_by_one = one_by_one || size <= slab_max_size;
+#endif
+    if (!one_by_one) {
+        return heap_malloc_batch(a, size, n, ptrs);
+    }
+    size_t k = 0;
+    while (k < n && (ptrs[k] = arena_malloc(a, size)) != NULL) {
+        k++;
+    }
+    return k;
+}
+
+/**
+ * @brief Restores the max-heap order below one entry of a binary heap of
+ * pointers, ordered by address.
+ *
+ * @param[in,out] ptrs The heap
+ * @param[in] i The entry that may be smaller than its children
+ * @param[in] n The number of entries in the heap
+ */
+static void sift_down(void **ptrs, size_t i, size_t n) {
+    for (size_t child; (child = 2 * i + 1) < n; i = child) {
+        if (child + 1 < n &&
+            (uintptr_t)ptrs[child + 1] > (uintptr_t)ptrs[child]) {
+            child++;
+        }
+        if ((uintptr_t)ptrs[i] >= (uintptr_t)ptrs[child]) {
+            return;
+        }
+        void *tmp = ptrs[i];
+        ptrs[i] = ptrs[child];
+        ptrs[child] = tmp;
+    }
+}
+
+/**
+ * @brief Sorts an array of pointers by address, in place and without
+ * allocating memory.
+ *
+ * @param[in,out] ptrs The array
+ * @param[in] n The number of pointers
+ */
+static void sort_pointers(void **ptrs, size_t n) {
+    size_t k = 1;
+    while (k < n && (uintptr_t)ptrs[k - 1] <= (uintptr_t)ptrs[k]) {
+        k++;
+    }
+    if (k >= n) {
+        return; // Already in order, as batches often are
+    }
+    for (size_t i = n / 2; i-- > 0;) {
+        sift_down(ptrs, i, n);
+    }
+    for (size_t end = n - 1; end > 0; end--) {
+        void *tmp = ptrs[0];
+        ptrs[0] = ptrs[end];
+        ptrs[end] = tmp;
+        sift_down(ptrs, 0, end);
+    }
+}
+
+/**
+ * @brief Frees payloads of an arena, sorted by address. Blocks that lie
+ * side by side in the heap are merged and coalesced with their neighbours
+ * once, as a single free block.
+ *
+ * @param[in] a The arena that holds the payloads
+ * @param[in] ptrs The payloads in increasing order; NULL entries are skipped
+ * @param[in] n The number of entries
+ */
+static void arena_free_batch(arena_t *a, void **ptrs, size_t n) {
+    dbg_requires(check_near(a, NULL));
+    size_t k = 0;
+    while (k < n) {
+        char *bp = ptrs[k++];
+        if (bp == NULL) {
+            continue;
+        }
+#if MM_SLAB_MAX
+        if (is_slab(bp)) {
+            slab_free(a, bp);
+            continue;
+        }
+#endif
+        block_t *block = payload_to_header(bp);
+#if MM_MAP_THRESHOLD
+        if (is_mapped(block)) {
+            huge_free(block);
+            continue;
+        }
+#endif
+        size_t size = get_size(block);
+        stats_count(&a->stats, size - wsize, false);
+        while (k < n && ptrs[k] == bp + size) {
+            size_t next_size = get_size(payload_to_header(ptrs[k++]));
+            stats_count(&a->stats, next_size - wsize, false);
+            size += next_size;
+        }
+        block = free_run(a, block, size);
+        dbg_assert(check_near(a, block));
+    }
+}
+
+#if MM_MAP_THRESHOLD
+/**
+ * @brief Resizes a block allocated by huge_malloc. The block stays where it
+ * is if its mapping would keep the same number of pages; otherwise it is
+ * moved, into an arena if it is no longer large enough for a mapping.
+ *
+ * @param[in] a The arena to move the block to
+ * @param[in] ptr A payload allocated by huge_malloc
+ * @param[in] size The size of the newly requested block.
+ * @return The pointer to the resized payload, or NULL
+ */
+static void *huge_realloc(arena_t *a, void *ptr, size_t size) {
+    block_t *block = payload_to_header(ptr);
+    size_t page = mem_pagesize();
+    size_t pad = huge_padding(block);
+    if (size == 0) {
+        huge_free(block);
+        return NULL;
+    }
+    if (size >= MM_MAP_THRESHOLD && size <= SIZE_MAX - page - pad - dsize &&
+        round_up(size + pad + dsize, page) == pad + get_size(block) + wsize) {
+        return ptr;
+    }
+    void *newptr = arena_malloc(a, size);
+    if (newptr == NULL) {
+        return NULL;
+    }
+    size_t copysize = get_payload_size(block);
+    memcpy(newptr, ptr, size < copysize ? size : copysize);
+    huge_free(block);
+    return newptr;
+}
+#endif
+
+/**
+ * @brief Resizes a payload held by an arena. A slab object keeps its place
+ * if the new size falls in the same class; otherwise it is moved. A heap
+ * block that grows to MM_MAP_THRESHOLD bytes or more is moved to a mapping,
+ * if memlib has room for one.
+ *
+ * @param[in] a The arena that holds the payload
+ * @param[in] ptr A payload returned by arena_malloc
+ * @param[in] size The size of the newly requested block.
+ * @return The pointer to the resized payload, or NULL
+ */
+static void *arena_realloc(arena_t *a, void *ptr, size_t size) {
+#if MM_SLAB_MAX
+    if (is_slab(ptr)) {
+        size_t old_size = slab_run_of(ptr)->size;
+        if (size > old_size - dsize && size <= old_size) {
+            return ptr;
+        }
+        void *newptr = NULL;
+        if (size != 0) {
+            if ((newptr = arena_malloc(a, size)) == NULL) {
+                return NULL;
+            }
+            memcpy(newptr, ptr, size < old_size ? size : old_size);
+        }
+        slab_free(a, ptr);
+        return newptr;
+    }
+#endif
+#if MM_MAP_THRESHOLD
+    block_t *block = payload_to_header(ptr);
+    if (is_mapped(block)) {
+        return huge_realloc(a, ptr, size);
+    }
+    // Move a block that grows this large out of the heap, if it can; one
+    // that is already this large, because mem_map had no room for it, is
+    // shrunk in place instead
+    if (size >= MM_MAP_THRESHOLD && size > get_payload_size(block)) {
+        void *newptr = huge_malloc(size, dsize);
+        if (newptr != NULL) {
+            memcpy(newptr, ptr, get_payload_size(block));
+            heap_free(a, ptr);
+            return newptr;
+        }
+    }
+#endif
+    return heap_realloc(a, ptr, size);
+}
+
+/**
+ * @brief Allocates zero-filled memory from an arena. Unlike malloc followed
+ * by memset, this leaves alone the part of a heap block that has never been
+ * written since the heap gained it.
+ *
+ * @param[in] a The arena
+ * @param[in] size The number of bytes to allocate and clear
+ * @return The pointer to the payload for the user to write, or NULL
+ */
+static void *arena_calloc(arena_t *a, size_t size) {
+#if MM_MAP_THRESHOLD
+    if (size >= MM_MAP_THRESHOLD) {
+        // mem_map hands out zeroed pages
+        void *bp = huge_malloc(size, dsize);
+        if (bp != NULL) {
+            if (!mem_zeroed()) {
+                memset(bp, 0, size);
+            }
+            return bp;
+        }
+    }
+#endif
+#if MM_SLAB_MAX
+    if (size != 0 && size <= slab_max_size) {
+        void *bp = slab_malloc(a, size);
+        if (bp != NULL) {
+            memset(bp, 0, size);
+            return bp;
+        }
+    }
+#endif
+    return heap_malloc(a, size, true);
+}
+
+/**
+ * @brief Allocates from an arena a payload aligned to `align` bytes. Huge
+ * requests get a mapping of their own if memlib has room for it, with as
+ * much padding in front as the alignment needs; everything else comes from
+ * the heap, never a slab run.
+ *
+ * @param[in] a The arena
+ * @param[in] align The alignment, a power of 2 greater than dsize
+ * @param[in] size The size that the user requires
+ * @return The pointer to the payload for the user to write, or NULL
+ */
+static void *arena_memalign(arena_t *a, size_t align, size_t size) {
+#if MM_MAP_THRESHOLD
+    if (size >= MM_MAP_THRESHOLD) {
+        void *bp = huge_malloc(size, align);
+        if (bp != NULL) {
+            return bp;
+        }
+    }
+#endif
+    return heap_memalign(a, align, size);
+}
+
+/**
+ * @brief Returns how many bytes a payload can hold, without holding its
+ * arena's lock.
+ *
+ * A neighbouring block may rewrite the pre_alloc bit of a block's header
+ * concurrently (under the lock), so the header is read atomically. The
+ * size bits themselves do not change while the block is allocated, and
+ * neither does the object size of a slab run with an object in use.
+ *
+ * @param[in] bp A payload owned by the calling thread
+ * @return The usable size of the payload
+ */
+static size_t usable_size_unlocked(void *bp) {
+#if MM_SLAB_MAX
+    if (is_slab(bp)) {
+        return slab_run_of(bp)->size;
+    }
+#endif
+    block_t *block = payload_to_header(bp);
+    return extract_size(__atomic_load_n(&block->header, __ATOMIC_RELAXED)) -
+           wsize;
+}
+
+#if MM_THREADS
+
+/**
+ * @brief Returns the arena the calling thread allocates from. Threads are
+ * given arenas round-robin the first time they allocate.
+ *
+ * @return The calling thread's arena
+ */
+static arena_t *thread_arena(void) {
+    if (tcache.arena == NULL) {
+        unsigned int k = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED);
+        tcache.arena = &arenas[k % MM_ARENAS];
+    }
+    return tcache.arena;
+}
+
+/**
+ * @brief Appends a block to the remote-free queue of the arena it belongs to.
+ *
+ * This never blocks and never retries: a single atomic exchange claims the
+ * tail, and the old tail is then linked to the block. Between those two
+ * steps the queue looks shorter to the consumer, which just stops there.
+ *
+ * @param[in] a The arena that holds the block
+ * @param[in] block An allocated block, or the arena's stub
+ */
+static void remote_push(arena_t *a, block_t *block) {
+    __atomic_store_n(&block->next, NULL, __ATOMIC_RELAXED);
+    block_t *prev =
+        __atomic_exchange_n(&a->remote_tail, block, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, block, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Takes the oldest block off an arena's remote-free queue.
+ * @param[in] a The arena, whose lock must be held
+ * @return The block, or NULL if there is none that can be taken yet
+ */
+static block_t *remote_pop(arena_t *a) {
+    block_t *head = a->remote_head;
+    block_t *next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (head == &a->remote_stub) {
+        // Skip the stub, which is not a real block
+        if (next == NULL) {
+            return NULL;
+        }
+        a->remote_head = next;
+        head = next;
+        next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    }
+    if (next != NULL) {
+        a->remote_head = next;
+        return head;
+    }
+    // head is the last node; it can only be taken once something follows it
+    if (head != __atomic_load_n(&a->remote_tail, __ATOMIC_ACQUIRE)) {
+        return NULL; // a push is halfway done
+    }
+    remote_push(a, &a->remote_stub);
+    next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (next != NULL) {
+        a->remote_head = next;
+        return head;
+    }
+    return NULL;
+}
 
-    block_t *block = payload_to_header(bp);
-    size_t size = get_size(block);
+/**
+ * @brief Frees every block that other threads have queued for an arena.
+ * @param[in] a The arena, whose lock must be held
+ */
+static void remote_drain(arena_t *a) {
+    block_t *block;
+    // The queue is set up along with the heap, and is empty until then
+    if (a->heap_start == NULL) {
+        return;
+    }
+    while ((block = remote_pop(a)) != NULL) {
+        arena_free(a, block->payload);
+    }
+}
 
-    // The block should be marked as allocated
-    dbg_assert(get_alloc(block));
+/**
+ * @brief Gives a chain of cached blocks back to the heap. Blocks from the
+ * calling thread's arena are freed under a single lock acquisition; blocks
+ * from other arenas are queued for their owners.
+ *
+ * @param[in] block The first block of a chain linked through `next`
+ */
+static void tcache_release(block_t *block) {
+    arena_t *own = thread_arena();
+    bool locked = false;
+    while (block != NULL) {
+        block_t *block_next = block->next;
+        arena_t *a = arena_of(block);
+        if (a != own) {
+            remote_push(a, block);
+        } else {
+            if (!locked) {
+                pthread_mutex_lock(&own->lock);
+                locked = true;
+            }
+            arena_free(own, block->payload);
+        }
+        block = block_next;
+    }
+    if (locked) {
+        pthread_mutex_unlock(&own->lock);
+    }
+}
 
-    // Mark the block as free
-    bool pre_allocate = get_pre_alloc(block);
-    write_block(block, size, false);
-    write_pre_alloc(block, pre_allocate);
-    write_pre_alloc(find_next(block), false);
-    // Try to coalesce the block with its neighbors
-    block = coalesce_block(block);
-    add_to_first(block);
-    dbg_ensures(mm_checkheap(__LINE__));
+/**
+ * @brief Gives every block in the calling thread's cache back to the heap.
+ * Runs automatically when a thread that used the cache exits.
+ *
+ * @param[in] arg The exiting thread's cache
+ */
+static void tcache_destroy(void *arg) {
+    struct tcache *tc = arg;
+    if (tc->generation != heap_generation) {
+        return;
+    }
+    for (int i = 0; i < TCACHE_BINS; i++) {
+        tcache_release(tc->bin[i]);
+        tc->bin[i] = NULL;
+        tc->count[i] = 0;
+    }
 }
 
 /**
- * @brief Reallocate the size of a allocated block.
- *  1. If the required size is 0 -> Same as freeing the block.
- *  2. If the ptr points to a null space, return the generic pointer generated
- * by malloc.
- *  3. If the malloc fails, return null and the original block is left
- * untouched.
- *  4. if the malloc is successful, copy the payload to the new allocated heap
- * and freed the original heap.
+ * @brief Creates the key whose destructor flushes a thread's cache.
+ */
+static void tcache_key_create(void) {
+    pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+/**
+ * @brief Maps the usable size of a freed block to its thread cache bin: the
+ * largest bin whose requests the block can hold.
+ * @param[in] usable The usable size of the block
+ * @return The bin index, which is TCACHE_BINS or more if the block is too
+ * large to be cached, or too small (a mini-block)
+ */
+static size_t tcache_index(size_t usable) {
+    if (usable < dsize) {
+        return TCACHE_BINS;
+    }
+    return usable / dsize - 1;
+}
+
+/**
+ * @brief Returns the calling thread's cache. If the heap has been
+ * reinitialized since the cache was last used, its blocks no longer exist
+ * and the cache is emptied.
  *
- * @param[in] ptr A generic pointer that needs to be reallocated.
- * @param[in] size The size of the newly requested block.
- * @return The original pointer and the size that the user wants to re-allocate.
+ * @return The calling thread's cache
  */
-void *realloc(void *ptr, size_t size) {
+static struct tcache *tcache_get(void) {
+    struct tcache *tc = &tcache;
+    if (tc->generation != heap_generation) {
+        for (int i = 0; i < TCACHE_BINS; i++) {
+            tc->bin[i] = NULL;
+            tc->count[i] = 0;
+        }
+        tc->generation = heap_generation;
+        if (!tc->registered) {
+            pthread_once(&tcache_once, tcache_key_create);
+            pthread_setspecific(tcache_key, tc);
+            tc->registered = true;
+        }
+    }
+    return tc;
+}
 
-    block_t *block = payload_to_header(ptr);
-    size_t copysize;
-    void *newptr;
+/**
+ * @brief Pushes a block onto a bin of a thread cache.
+ * @param[in] tc The cache
+ * @param[in] i The bin
+ * @param[in] bp A payload that can hold the requests of bin `i`
+ */
+static void tcache_push(struct tcache *tc, size_t i, void *bp) {
+    block_t *block = payload_to_header(bp);
+    block->next = tc->bin[i];
+    tc->bin[i] = block;
+    tc->count[i]++;
+}
 
-    // If size == 0, then free block and return NULL
-    if (size == 0) {
-        free(ptr);
-        return NULL;
+/**
+ * @brief Allocates a batch of blocks of the same size from the calling
+ * thread's arena under a single lock acquisition. One is returned to the
+ * caller and the rest are kept in the thread's cache. A block that came out
+ * larger than the cache can hold (because splitting it would have left a
+ * sliver) is given straight back. Blocks queued by other threads are freed
+ * first, so that they can be reused.
+ *
+ * @param[in] size The size that the user requires
+ * @return The pointer to the payload for the user to write, or NULL
+ */
+static void *tcache_refill(size_t size) {
+    struct tcache *tc = tcache_get();
+    arena_t *a = thread_arena();
+    pthread_mutex_lock(&a->lock);
+    remote_drain(a);
+    void *bp = arena_malloc(a, size);
+    for (int n = 1; bp != NULL && n < tcache_batch; n++) {
+        void *extra = arena_malloc(a, size);
+        if (extra == NULL) {
+            break;
+        }
+        size_t i = tcache_index(usable_size_unlocked(extra));
+        if (i >= TCACHE_BINS || tc->count[i] == tcache_bin_limit) {
+            arena_free(a, extra);
+            break;
+        }
+        tcache_push(tc, i, extra);
     }
+    pthread_mutex_unlock(&a->lock);
+    return bp;
+}
 
-    // If ptr is NULL, then equivalent to malloc
-    if (ptr == NULL) {
-        return malloc(size);
+/**
+ * @brief Gives the oldest half of a full bin back to the heap.
+ *
+ * @param[in] tc The calling thread's cache
+ * @param[in] i The bin to flush
+ */
+static void tcache_flush(struct tcache *tc, size_t i) {
+    // Keep the most recently freed blocks, which are likely still in cache
+    block_t *keep = tc->bin[i];
+    for (int k = 1; k < tcache_bin_limit - tcache_batch; k++) {
+        keep = keep->next;
     }
+    block_t *block = keep->next;
+    keep->next = NULL;
+    tc->count[i] = tcache_bin_limit - tcache_batch;
+    tcache_release(block);
+}
 
-    // Otherwise, proceed with reallocation
-    newptr = malloc(size);
+/**
+ * @brief Frees a payload in the multi-threaded build. Small blocks go to
+ * the calling thread's cache, which gives part of a bin back to the heap
+ * whenever the bin is full. Other blocks are freed into the calling thread's
+ * arena under its lock, or, if they came from another arena, queued for
+ * that arena without waiting on anything.
+ *
+ * @param[in] bp A payload returned by malloc, calloc or realloc
+ * @param[in] i The cache bin for its usable size, or for any smaller size
+ */
+static void thread_free(void *bp, size_t i) {
+    if (i < TCACHE_BINS) {
+        struct tcache *tc = tcache_get();
+        if (tc->count[i] == tcache_bin_limit) {
+            tcache_flush(tc, i);
+        }
+        tcache_push(tc, i, bp);
+        return;
+    }
 
-    // If malloc fails, the original block is left untouched
-    if (newptr == NULL) {
-        return NULL;
+    block_t *block = payload_to_header(bp);
+#if MM_MAP_THRESHOLD
+    if (is_mapped(block)) {
+        huge_free(block);
+        return;
+    }
+#endif
+    arena_t *a = arena_of(block);
+    if (a != thread_arena()) {
+        remote_push(a, block);
+        return;
     }
+    pthread_mutex_lock(&a->lock);
+    arena_free(a, bp);
+    pthread_mutex_unlock(&a->lock);
+}
+#endif /* MM_THREADS */
 
-    // Copy the old data
-    copysize = get_payload_size(block); // gets size of old payload
-    if (size < copysize) {
-        copysize = size;
+/**
+ * @brief Allocates a block of at least `size` bytes.
+ *
+ * In the multi-threaded build small requests are served from the calling
+ * thread's cache, and everything else takes the lock of the thread's arena
+ * and first frees whatever other threads have queued for that arena.
+ *
+ * @param[in] size The size that the user requires
+ * @return The pointer to the payload for the user to write
+ */
+void *malloc(size_t size) {
+#if MM_THREADS
+    if (size != 0 && size <= tcache_max_size) {
+        struct tcache *tc = tcache_get();
+        size_t i = (size - 1) / dsize;
+        block_t *block = tc->bin[i];
+        if (block != NULL) {
+            tc->bin[i] = block->next;
+            tc->count[i]--;
+            return block->payload;
+        }
+        return tcache_refill(size);
     }
 
-    memcpy(newptr, ptr, copysize);
+    arena_t *a = thread_arena();
+    pthread_mutex_lock(&a->lock);
+    remote_drain(a);
+    void *bp = arena_malloc(a, size);
+    pthread_mutex_unlock(&a->lock);
+    return bp;
+#else
+    return arena_malloc(&arenas[0], size);
+#endif
+}
 
-    // Free the old block
-    free(ptr);
+/**
+ * @brief Frees a block returned by malloc, calloc or realloc.
+ *
+ * In the multi-threaded build small blocks go to the calling thread's cache,
+ * which gives part of a bin back to the heap whenever the bin is full. Other
+ * blocks are freed into the calling thread's arena under its lock, or, if
+ * they came from another arena, queued for that arena without waiting on
+ * anything.
+ *
+ * @param[in] bp A pointer that points to a starting point of a payload.
+ */
+void free(void *bp) {
+#if MM_THREADS
+    if (bp == NULL) {
+        return;
+    }
+    thread_free(bp, tcache_index(usable_size_unlocked(bp)));
+#else
+    arena_free(&arenas[0], bp);
+#endif
+}
 
+/**
+ * @brief Changes the size of a block returned by malloc, calloc or realloc,
+ * keeping its contents up to the smaller of the old and new sizes. A block
+ * that has to move stays in the same arena.
+ *
+ * @param[in] ptr A generic pointer that needs to be reallocated.
+ * @param[in] size The size of the newly requested block.
+ * @return The pointer to the resized payload, or NULL
+ */
+void *realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+    arena_t *a = arena_of(payload_to_header(ptr));
+#if MM_THREADS
+    pthread_mutex_lock(&a->lock);
+    void *newptr = arena_realloc(a, ptr, size);
+    pthread_mutex_unlock(&a->lock);
     return newptr;
+#else
+    return arena_realloc(a, ptr, size);
+#endif
 }
 
 /**
- * @brief Same as Malloc, but set all the payload bits to 0.
+ * @brief Same as Malloc, but set all the payload bits to 0. Memory that
+ * has never been handed out is known to be zero already and is not cleared
+ * again.
  *
  * @param[in] elements The size of the single element based on its datatype
  * @param[in] size The number of the variable.
  * @return A generic pointer.
  */
 void *calloc(size_t elements, size_t size) {
-    void *bp;
     size_t asize = elements * size;
 
     if (elements == 0) {
@@ -981,16 +3955,336 @@ void *calloc(size_t elements, size_t size) {
         return NULL;
     }
 
-    bp = malloc(asize);
+#if MM_THREADS
+    if (asize <= tcache_max_size) {
+        // Cached blocks are rarely clean; clearing a small one is cheap
+        void *bp = malloc(asize);
+        if (bp != NULL) {
+            memset(bp, 0, asize);
+        }
+        return bp;
+    }
+
+    arena_t *a = thread_arena();
+    pthread_mutex_lock(&a->lock);
+    remote_drain(a);
+    void *bp = arena_calloc(a, asize);
+    pthread_mutex_unlock(&a->lock);
+    return bp;
+#else
+    return arena_calloc(&arenas[0], asize);
+#endif
+}
+
+/**
+ * @brief Allocates `n` blocks of `size` bytes each, as if by `n` calls to
+ * malloc, but with a single free-list search for blocks that come from the
+ * heap: they are carved side by side from one free block.
+ *
+ * @param[in] size The size of every block
+ * @param[in] n The number of blocks
+ * @param[out] ptrs An array of `n` entries that receives the payloads
+ * @return The number of blocks allocated, which is less than `n` only if
+ * memory runs out; the first that many entries of `ptrs` are then set
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **ptrs) {
+#if MM_THREADS
+    arena_t *a = thread_arena();
+    pthread_mutex_lock(&a->lock);
+    remote_drain(a);
+    size_t count = arena_malloc_batch(a, size, n, ptrs);
+    pthread_mutex_unlock(&a->lock);
+    return count;
+#else
+    return arena_malloc_batch(&arenas[0], size, n, ptrs);
+#endif
+}
+
+/**
+ * @brief Frees `n` blocks, as if by `n` calls to free. Blocks that lie side
+ * by side in the heap are coalesced with their neighbours once, as a group.
+ *
+ * In the multi-threaded build the blocks bypass the thread cache: those of
+ * the calling thread's arena are freed under one lock acquisition, and the
+ * others are queued for their arenas.
+ *
+ * @param[in,out] ptrs The payloads to free, NULL entries included; the
+ * array is reordered in the process
+ * @param[in] n The number of entries
+ */
+void mm_free_batch(void **ptrs, size_t n) {
+    sort_pointers(ptrs, n);
+#if MM_THREADS
+    arena_t *own = thread_arena();
+    size_t count = 0;
+    for (size_t k = 0; k < n; k++) {
+        if (ptrs[k] == NULL) {
+            continue;
+        }
+        block_t *block = payload_to_header(ptrs[k]);
+#if MM_MAP_THRESHOLD
+        // A slab object has no header, but it is never this large
+        if (usable_size_unlocked(ptrs[k]) >= MM_MAP_THRESHOLD &&
+            is_mapped(block)) {
+            huge_free(block);
+            continue;
+        }
+#endif
+        arena_t *a = arena_of(block);
+        if (a != own) {
+            remote_push(a, block);
+            continue;
+        }
+        // Keep the calling thread's blocks, still in order, at the front
+        ptrs[count++] = ptrs[k];
+    }
+    if (count != 0) {
+        pthread_mutex_lock(&own->lock);
+        remote_drain(own);
+        arena_free_batch(own, ptrs, count);
+        pthread_mutex_unlock(&own->lock);
+    }
+#else
+    arena_free_batch(&arenas[0], ptrs, n);
+#endif
+}
+
+/**
+ * @brief Frees a block whose size the caller knows, as free does.
+ *
+ * The size picks the thread cache bin, or with a single arena the quick
+ * list, without reading the block's header, and rules out a slab object or
+ * a mapped block without looking. Debug builds check the size against the
+ * header.
+ *
+ * @param[in] bp A payload returned by malloc, calloc or realloc, or NULL
+ * @param[in] size The size last requested for the payload
+ */
+void mm_free_sized(void *bp, size_t size) {
     if (bp == NULL) {
-        return NULL;
+        return;
+    }
+    dbg_requires(size <= usable_size_unlocked(bp));
+#if MM_MAP_THRESHOLD
+    // Only requests of at least MM_MAP_THRESHOLD bytes are ever mapped, but
+    // those may have come from the heap when mem_map had no room
+    if (size >= MM_MAP_THRESHOLD && is_mapped(payload_to_header(bp))) {
+        huge_free(payload_to_header(bp));
+        return;
     }
+#endif
+#if MM_THREADS
+    // Sizes below dsize share a bin with larger ones that they cannot name
+    thread_free(bp, tcache_index(size < dsize ? usable_size_unlocked(bp)
+                                              : size));
+#else
+    arena_free_sized(&arenas[0], bp, size);
+#endif
+}
 
-    // Initialize all bits to 0
-    memset(bp, 0, asize);
+/**
+ * @brief Returns how many bytes the payload of a block can hold: at least
+ * the size requested for it, and often a little more, which the caller may
+ * use without calling realloc.
+ *
+ * @param[in] bp A payload returned by malloc, calloc or realloc, or NULL
+ * @return The usable size of the payload, or 0 for NULL
+ */
+size_t mm_malloc_usable_size(void *bp) {
+    if (bp == NULL) {
+        return 0;
+    }
+    return usable_size_unlocked(bp);
+}
 
+/**
+ * @brief Allocates a block whose payload address is a multiple of
+ * `alignment`, as C11 aligned_alloc does.
+ *
+ * @param[in] alignment The alignment, a power of 2
+ * @param[in] size The size that the user requires
+ * @return The pointer to the payload for the user to write, or NULL if
+ * memory runs out, `size` is 0 or `alignment` is not a power of 2
+ */
+void *mm_aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+    if (alignment <= dsize) {
+        return malloc(size);
+    }
+#if MM_THREADS
+    arena_t *a = thread_arena();
+    pthread_mutex_lock(&a->lock);
+    remote_drain(a);
+    void *bp = arena_memalign(a, alignment, size);
+    pthread_mutex_unlock(&a->lock);
     return bp;
+#else
+    return arena_memalign(&arenas[0], alignment, size);
+#endif
+}
+
+/**
+ * @brief Allocates a block whose payload address is a multiple of
+ * `alignment`, as POSIX posix_memalign does.
+ *
+ * @param[out] memptr Receives the payload, or NULL if `size` is 0
+ * @param[in] alignment The alignment, a power of 2 and a multiple of
+ * sizeof(void *)
+ * @param[in] size The size that the user requires
+ * @return 0 on success, EINVAL for a bad alignment, ENOMEM if memory runs
+ * out
+ */
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment == 0 || alignment % sizeof(void *) != 0 ||
+        (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *bp = mm_aligned_alloc(alignment, size);
+    if (bp == NULL && size != 0) {
+        return ENOMEM;
+    }
+    *memptr = bp;
+    return 0;
+}
+
+/**
+ * @brief Sets how arenas grow when no free block fits a request. Each
+ * extension is at least 1/2^shift of the arena's size, and at most
+ * max_step bytes more than the request needs; a shift of 0 extends by
+ * chunksize only. The defaults are MM_GROW_SHIFT and MM_GROW_MAX.
+ *
+ * Not safe to call while other threads are allocating.
+ *
+ * @param[in] shift The share of the heap to grow by, as a power of 2
+ * @param[in] max_step The largest extension in bytes, or 0 for no limit
+ */
+void mm_set_growth(unsigned int shift, size_t max_step) {
+    grow_shift = shift < 8 * sizeof(size_t) ? shift : 0;
+    grow_max = max_step != 0 ? max_step : SIZE_MAX;
+}
+
+/**
+ * @brief Adds the counters of one arena to a snapshot, and counts the
+ * blocks on its free lists. An arena not set up since mm_init has none.
+ *
+ * @param[in,out] stats The snapshot
+ * @param[in] a The arena, which must not be changed meanwhile
+ */
+static void stats_add_arena(struct mm_stats *stats, arena_t *a) {
+    const struct mm_stats *s = &a->stats;
+    if (a->heap_start == NULL) {
+        return;
+    }
+    for (int i = 0; i < GROUP_COUNT; i++) {
+        stats->allocs[i] += s->allocs[i];
+        stats->frees[i] += s->frees[i];
+    }
+    for (int i = 0; i < MM_STATS_PROBE_BUCKETS; i++) {
+        stats->probes[i] += s->probes[i];
+    }
+    stats->splits += s->splits;
+    stats->coalesces += s->coalesces;
+    stats->extends += s->extends;
+    stats->extend_bytes += s->extend_bytes;
+    stats->live_bytes += s->live_bytes;
+    stats->peak_bytes += s->peak_bytes;
+
+    for (int i = 0; i < GROUP_COUNT; i++) {
+        for (block_t *b = a->list_start[i]; b != NULL; b = get_next(b)) {
+            stats->list_length[i]++;
+        }
+    }
+    for (block_t *b = a->mini_start; b != NULL; b = get_next(b)) {
+        stats->mini_length++;
+    }
+    block_t *node = a->tree_root == NULL ? NULL : tree_minimum(a->tree_root);
+    for (; node != NULL; node = tree_successor(node)) {
+        for (block_t *b = node; b != NULL; b = b->next) {
+            stats->tree_length++;
+        }
+    }
+}
+
+/**
+ * @brief Fills in a snapshot of the allocator's counters since the last
+ * mm_init, summed over all arenas (see mm-stats.h). The free-list lengths
+ * are counted by walking the lists, so this takes time in proportion to
+ * the number of free blocks.
+ *
+ * In the multi-threaded build, blocks held in the thread caches count as
+ * allocated, and peak_bytes is the sum of the peaks of each arena, which
+ * may be more than was ever in use at once. Each arena is locked while it
+ * is read.
+ *
+ * @param[out] stats Receives the statistics
+ * @return true if the counters are kept (MM_STATS), false if not; only the
+ * class sizes are filled in then
+ */
+bool mm_stats(struct mm_stats *stats) {
+    *stats = (struct mm_stats){.enabled = MM_STATS};
+    for (int i = 0; i < GROUP_COUNT; i++) {
+        // Inverse of calculate_group; groups past the largest size are unused
+        if (i < exact_groups) {
+            stats->class_size[i] = min_group_size + (size_t)i * dsize;
+            continue;
+        }
+        int msb = class_min_shift + ((i - exact_groups) >> class_sub_bits);
+        int sub = (i - exact_groups) & ((1 << class_sub_bits) - 1);
+        if (msb < 64) {
+            stats->class_size[i] = ((size_t)1 << msb) +
+                                   ((size_t)sub << (msb - class_sub_bits));
+        }
+    }
+    if (!MM_STATS) {
+        return false;
+    }
+
+    for (int k = 0; k < MM_ARENAS; k++) {
+#if MM_THREADS
+        pthread_mutex_lock(&arenas[k].lock);
+        stats_add_arena(stats, &arenas[k]);
+        pthread_mutex_unlock(&arenas[k].lock);
+#else
+        stats_add_arena(stats, &arenas[k]);
+#endif
+    }
+#if MM_THREADS
+    pthread_mutex_lock(&mapped_stats_lock);
+    const struct mm_stats *s = &mapped_stats;
+    for (int i = 0; i < GROUP_COUNT; i++) {
+        stats->allocs[i] += s->allocs[i];
+        stats->frees[i] += s->frees[i];
+    }
+    stats->live_bytes += s->live_bytes;
+    stats->peak_bytes += s->peak_bytes;
+    pthread_mutex_unlock(&mapped_stats_lock);
+#endif
+    return true;
+}
+
+#if MM_TUNE
+/**
+ * @brief Sets the size-class options, which take effect at the next
+ * mm_init. Only built with MM_TUNE, for mmtune.
+ *
+ * @param[in] sub_bits The value of MM_CLASS_SUB_BITS to use
+ * @param[in] probes The value of MM_FIT_PROBES to use
+ * @param[in] tree_shift The value of MM_TREE_MIN_SHIFT to use
+ * @return false, changing nothing, if a value is out of range
+ */
+bool mm_tune(int sub_bits, int probes, int tree_shift) {
+    if (sub_bits < 0 || sub_bits > 5 || probes < 1 || tree_shift < 8 ||
+        tree_shift > 20) {
+        return false;
+    }
+    class_sub_bits = sub_bits;
+    fit_probes = probes;
+    tree_min_size = (size_t)1 << tree_shift;
+    return true;
 }
+#endif
 
 /*
  *****************************************************************************
@@ -0,0 +1,456 @@
+/*
+ * mmtune.c - Size-class autotuner for the malloc package
+ *
+ * Replays a set of traces against mm.c (built with -DMM_TUNE=1) under many
+ * size-class options, and writes the best options it finds to a header,
+ * mm-classes.h by default, which mm.c includes whenever it is present.
+ *
+ * The options are the number of free lists per power of two above 1 KiB
+ * (MM_CLASS_SUB_BITS), the number of fitting blocks that a free-list search
+ * compares (MM_FIT_PROBES), and the smallest free block kept in the size
+ * tree (MM_TREE_MIN_SHIFT).
+ *
+ * Each candidate is scored the way mdriver scores mm.c: the average
+ * utilization is scaled between MIN_SPACE and MAX_SPACE, the harmonic mean
+ * throughput between MIN_SPEED_RATIO and MAX_SPEED_RATIO times a reference
+ * throughput, and the two are weighted by UTIL_WEIGHT. mdriver caps each
+ * part once its target is met; candidates are ranked on the uncapped sum
+ * instead, so that the search still has a direction past the targets.
+ *
+ * The search is coordinate descent: starting from the options mm.c was
+ * built with, it tries every value of one option while holding the others
+ * fixed, keeps the best, and moves on to the next option, until a whole
+ * round changes nothing.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "memlib.h"
+#include "mm.h"
+
+/* The options mm.c was built with, where the search starts */
+#if defined(__has_include)
+#if __has_include("mm-classes.h")
+#include "mm-classes.h"
+#endif
+#endif
+#ifndef MM_CLASS_SUB_BITS
+#define MM_CLASS_SUB_BITS 2
+#endif
+#ifndef MM_FIT_PROBES
+#define MM_FIT_PROBES 7
+#endif
+#ifndef MM_TREE_MIN_SHIFT
+#define MM_TREE_MIN_SHIFT 12
+#endif
+
+/* Defaults for the command line options */
+#define DEFAULT_HEADER "mm-classes.h"
+#define DEFAULT_REPS 3 /* timed replays of each trace, fastest counts */
+
+#define MAXLINE 1024 /* longest file name */
+#define NOPTIONS 3   /* number of options searched */
+
+/* Size-class entry point of mm.c, built only with MM_TUNE */
+bool mm_tune(int sub_bits, int probes, int tree_shift);
+
+/* One request of a trace */
+typedef struct
+{
+    char type; /* 'a', 'r' or 'f' */
+    int index; /* block id */
+    size_t size;
+} op_t;
+
+/* A trace, read into memory once */
+typedef struct
+{
+    char name[MAXLINE];
+    int weight; /* 0 ignore, 1 util and throughput, 2 util, 3 throughput */
+    int num_ids;
+    int num_ops;
+    op_t *ops;
+    char **blocks;  /* payload of each block id */
+    size_t *sizes;  /* requested size of each block id */
+} trace_t;
+
+/* Values tried for each option, and the option names in the header */
+static const int option_values[NOPTIONS][8] = {
+    {0, 1, 2, 3, 4, 5, -1},
+    {1, 2, 4, 7, 12, 20, 64, -1},
+    {9, 10, 11, 12, 13, 14, -1}};
+static const char *option_names[NOPTIONS] = {
+    "MM_CLASS_SUB_BITS", "MM_FIT_PROBES", "MM_TREE_MIN_SHIFT"};
+
+/* Result of replaying every trace under one candidate */
+typedef struct
+{
+    int option[NOPTIONS];
+    bool valid;
+    double util; /* average utilization */
+    double tput; /* harmonic mean throughput, in Kops/s */
+    double score;
+} result_t;
+
+static int reps = DEFAULT_REPS;
+static double ref_tput = 0.0; /* reference throughput, in Kops/s */
+static bool verbose = false;
+
+/* Seconds elapsed on a monotonic clock */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * read_trace - Read a trace file in the format that mdriver reads. Exits
+ *     on error.
+ */
+static void read_trace(trace_t *trace, const char *dir, const char *file)
+{
+    FILE *fp;
+    size_t data_bytes;
+    char type[2];
+    int i;
+
+    snprintf(trace->name, sizeof(trace->name), "%s%s", dir, file);
+    if ((fp = fopen(trace->name, "r")) == NULL)
+    {
+        fprintf(stderr, "Could not open %s\n", trace->name);
+        exit(1);
+    }
+    if (fscanf(fp, "%d %d %d %zu", &trace->weight, &trace->num_ids,
+               &trace->num_ops, &data_bytes) != 4)
+    {
+        fprintf(stderr, "%s: bad header\n", trace->name);
+        exit(1);
+    }
+    trace->ops = calloc(trace->num_ops, sizeof(op_t));
+    trace->blocks = calloc(trace->num_ids, sizeof(char *));
+    trace->sizes = calloc(trace->num_ids, sizeof(size_t));
+    if (trace->ops == NULL || trace->blocks == NULL || trace->sizes == NULL)
+    {
+        fprintf(stderr, "calloc failed\n");
+        exit(1);
+    }
+    for (i = 0; i < trace->num_ops; i++)
+    {
+        op_t *op = &trace->ops[i];
+        if (fscanf(fp, "%1s %d", type, &op->index) != 2 ||
+            (type[0] != 'f' && fscanf(fp, "%zu", &op->size) != 1) ||
+            strchr("arf", type[0]) == NULL || op->index >= trace->num_ids)
+        {
+            fprintf(stderr, "%s: bad request %d\n", trace->name, i);
+            exit(1);
+        }
+        op->type = type[0];
+    }
+    fclose(fp);
+}
+
+/*
+ * replay - Run a trace against a fresh heap. Stores the peak number of
+ *     requested bytes in *peak, if peak is not NULL. Returns false if a
+ *     request fails.
+ */
+static bool replay(trace_t *trace, size_t *peak)
+{
+    size_t total = 0;
+    size_t max_total = 0;
+    int i;
+
+    mem_reset_brk();
+    if (!mm_init())
+        return false;
+    for (i = 0; i < trace->num_ops; i++)
+    {
+        op_t *op = &trace->ops[i];
+        char *p;
+        switch (op->type)
+        {
+        case 'a':
+            if ((p = mm_malloc(op->size)) == NULL)
+                return false;
+            trace->blocks[op->index] = p;
+            trace->sizes[op->index] = op->size;
+            total += op->size;
+            break;
+        case 'r':
+            p = mm_realloc(trace->blocks[op->index], op->size);
+            if (p == NULL && op->size != 0)
+                return false;
+            trace->blocks[op->index] = p;
+            total += op->size - trace->sizes[op->index];
+            trace->sizes[op->index] = op->size;
+            break;
+        default:
+            if (op->index >= 0)
+            {
+                mm_free(trace->blocks[op->index]);
+                total -= trace->sizes[op->index];
+                trace->sizes[op->index] = 0;
+            }
+            break;
+        }
+        if (total > max_total)
+            max_total = total;
+    }
+    if (peak != NULL)
+        *peak = max_total;
+    return true;
+}
+
+/*
+ * scaled - Scale x between lo and hi as mdriver does, but without capping
+ *     it at 1 above hi.
+ */
+static double scaled(double x, double lo, double hi)
+{
+    return x < lo ? 0.0 : (x - lo) / (hi - lo);
+}
+
+/*
+ * evaluate - Replay every trace under the options in r->option, and fill in
+ *     the rest of r.
+ */
+static void evaluate(result_t *r, trace_t *traces, int ntraces)
+{
+    double util = 0.0;
+    double inverse_tput = 0.0;
+    int nutil = 0;
+    int ntput = 0;
+    int i, k;
+
+    r->valid = mm_tune(r->option[0], r->option[1], r->option[2]);
+    for (i = 0; i < ntraces && r->valid; i++)
+    {
+        trace_t *trace = &traces[i];
+        size_t peak;
+        if (trace->weight == 0)
+            continue;
+        if (!replay(trace, &peak))
+        {
+            r->valid = false;
+            break;
+        }
+        if (trace->weight != 3)
+        {
+            util += (double)peak / (double)mem_heap_peak();
+            nutil++;
+        }
+        if (trace->weight == 2)
+            continue;
+        double best = -1.0;
+        for (k = 0; k < reps; k++)
+        {
+            double start = now();
+            r->valid = replay(trace, NULL) && r->valid;
+            double secs = now() - start;
+            if (best < 0 || secs < best)
+                best = secs;
+        }
+        inverse_tput += best * 1000.0 / trace->num_ops;
+        ntput++;
+    }
+
+    r->util = nutil > 0 ? util / nutil : 0.0;
+    r->tput = ntput > 0 ? ntput / inverse_tput : 0.0;
+    r->score =
+        UTIL_WEIGHT * scaled(r->util, MIN_SPACE, MAX_SPACE) +
+        (1.0 - UTIL_WEIGHT) * scaled(r->tput, MIN_SPEED_RATIO * ref_tput,
+                                     MAX_SPEED_RATIO * ref_tput);
+    if (!r->valid)
+        r->score = -1.0;
+    if (verbose)
+        printf("%2d %3d %3d  %6.1f%% %9.0f %8.3f%s\n", r->option[0],
+               r->option[1], r->option[2], r->util * 100, r->tput, r->score,
+               r->valid ? "" : "  failed");
+}
+
+/*
+ * write_header - Write the options of r to a header that mm.c includes
+ */
+static void write_header(const char *path, const result_t *r, int ntraces)
+{
+    FILE *fp = fopen(path, "w");
+    int j;
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Could not write %s\n", path);
+        exit(1);
+    }
+    fprintf(fp, "/*\n");
+    fprintf(fp, " * %s - Size-class options for mm.c\n", path);
+    fprintf(fp, " *\n");
+    fprintf(fp, " * Generated by mmtune from %d traces. Do not edit; run "
+                "mmtune again, or\n", ntraces);
+    fprintf(fp, " * delete this file to build mm.c with its own "
+                "defaults.\n");
+    fprintf(fp, " *\n");
+    fprintf(fp, " * Average utilization %.1f%%, throughput %.0f Kops/s, "
+                "score %.3f\n", r->util * 100, r->tput, r->score);
+    fprintf(fp, " */\n");
+    fprintf(fp, "#ifndef MM_CLASSES_H\n");
+    fprintf(fp, "#define MM_CLASSES_H\n");
+    for (j = 0; j < NOPTIONS; j++)
+    {
+        fprintf(fp, "\n#ifndef %s\n", option_names[j]);
+        fprintf(fp, "#define %s %d\n", option_names[j], r->option[j]);
+        fprintf(fp, "#endif\n");
+    }
+    fprintf(fp, "\n#endif /* MM_CLASSES_H */\n");
+    fclose(fp);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(char *prog)
+{
+    fprintf(stderr, "Usage: %s [-hv] [-t <dir>] [-f <file>]... [-o <file>] "
+                    "[-n <reps>] [-r <Kops>]\n", prog);
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-v         Print the result of every candidate.\n");
+    fprintf(stderr, "\t-t <dir>   Directory of the trace files "
+                    "(default %s).\n", TRACEDIR);
+    fprintf(stderr, "\t-f <file>  Tune on <file> instead of the default "
+                    "traces.\n");
+    fprintf(stderr, "\t-o <file>  Header to write (default %s).\n",
+            DEFAULT_HEADER);
+    fprintf(stderr, "\t-n <reps>  Timed replays of each trace "
+                    "(default %d).\n", DEFAULT_REPS);
+    fprintf(stderr, "\t-r <Kops>  Reference throughput (default: that of "
+                    "the starting options).\n");
+}
+
+int main(int argc, char **argv)
+{
+    static const char *default_files[] = {DEFAULT_TRACEFILES};
+    const char **files = NULL;
+    const char *dir = TRACEDIR;
+    const char *header = DEFAULT_HEADER;
+    int nfiles = 0;
+    trace_t *traces;
+    result_t best, cand;
+    bool changed;
+    int c, i, j, k;
+
+    while ((c = getopt(argc, argv, "hvt:f:o:n:r:")) != EOF)
+    {
+        switch (c)
+        {
+        case 'v':
+            verbose = true;
+            break;
+        case 't':
+            dir = optarg;
+            break;
+        case 'f':
+            files = realloc(files, (nfiles + 1) * sizeof(char *));
+            if (files == NULL)
+            {
+                fprintf(stderr, "realloc failed\n");
+                exit(1);
+            }
+            files[nfiles++] = optarg;
+            break;
+        case 'o':
+            header = optarg;
+            break;
+        case 'n':
+            reps = atoi(optarg);
+            break;
+        case 'r':
+            ref_tput = atof(optarg);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (reps < 1 || ref_tput < 0)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+    if (nfiles == 0)
+    {
+        files = default_files;
+        nfiles = sizeof(default_files) / sizeof(default_files[0]);
+    }
+
+    if ((traces = calloc(nfiles, sizeof(trace_t))) == NULL)
+    {
+        fprintf(stderr, "calloc failed\n");
+        exit(1);
+    }
+    for (i = 0; i < nfiles; i++)
+        read_trace(&traces[i], dir, files[i]);
+
+    mem_init(false);
+    best.option[0] = MM_CLASS_SUB_BITS;
+    best.option[1] = MM_FIT_PROBES;
+    best.option[2] = MM_TREE_MIN_SHIFT;
+    if (ref_tput == 0)
+    {
+        /* Measure the starting options first, to serve as the reference */
+        ref_tput = 1.0;
+        evaluate(&best, traces, nfiles);
+        ref_tput = best.tput;
+    }
+    if (verbose)
+        printf("sub probes tree    util    Kops/s    score\n");
+    evaluate(&best, traces, nfiles);
+    if (!best.valid)
+    {
+        fprintf(stderr, "The starting options fail on these traces\n");
+        mem_deinit();
+        exit(1);
+    }
+    printf("start: %s %d, %s %d, %s %d: util %.1f%%, %.0f Kops/s, "
+           "score %.3f\n", option_names[0], best.option[0], option_names[1],
+           best.option[1], option_names[2], best.option[2], best.util * 100,
+           best.tput, best.score);
+
+    do
+    {
+        changed = false;
+        for (j = 0; j < NOPTIONS; j++)
+        {
+            for (k = 0; option_values[j][k] >= 0; k++)
+            {
+                if (option_values[j][k] == best.option[j])
+                    continue;
+                cand = best;
+                cand.option[j] = option_values[j][k];
+                evaluate(&cand, traces, nfiles);
+                if (cand.valid && cand.score > best.score)
+                {
+                    best = cand;
+                    changed = true;
+                }
+            }
+        }
+    } while (changed);
+
+    printf("best:  %s %d, %s %d, %s %d: util %.1f%%, %.0f Kops/s, "
+           "score %.3f\n", option_names[0], best.option[0], option_names[1],
+           best.option[1], option_names[2], best.option[2], best.util * 100,
+           best.tput, best.score);
+    write_header(header, &best, nfiles);
+    printf("wrote %s\n", header);
+    mem_deinit();
+    return 0;
+}
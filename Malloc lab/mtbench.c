@@ -0,0 +1,343 @@
+/*
+ * mtbench.c - Multi-threaded stress benchmark for the malloc package
+ *
+ * Runs the same random malloc/free workload on 1, 2, ..., N threads at once
+ * and reports the aggregate throughput for each thread count, which shows
+ * how well mm.c (built with -DMM_THREADS=1) scales across cores.
+ *
+ * Every thread owns a table of slots. At each step it picks a random slot
+ * and frees the block held there, or allocates a new block of a random size
+ * if the slot is empty. Most requests are small, the way they are in the
+ * bdd, cbit and ngram traces; a few are large enough to bypass any
+ * per-thread caching.
+ *
+ * With -p the threads instead form a pipeline: each one allocates blocks
+ * and hands them through a ring buffer to the next thread, which frees
+ * them. Nearly every free is then made by a thread other than the one
+ * that allocated the block.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+/* Defaults for the command line options */
+#define DEFAULT_OPS 1000000 /* operations per thread */
+#define DEFAULT_SLOTS 1000  /* live blocks per thread */
+#define SMALL_MAX 240       /* largest "small" request, in bytes */
+#define LARGE_MAX 4096      /* largest request, in bytes */
+#define LARGE_PERCENT 5     /* percentage of requests that may be large */
+#define RING_SIZE 256       /* blocks in flight between pipeline stages */
+
+/* Single-producer single-consumer queue between two pipeline stages */
+typedef struct
+{
+    char *slot[RING_SIZE];
+    unsigned long head; /* next slot to read, written by the consumer */
+    unsigned long tail; /* next slot to write, written by the producer */
+    bool done;          /* set once the producer has pushed its last block */
+} ring_t;
+
+/* Work description and result for one thread */
+typedef struct
+{
+    int id;
+    long ops;
+    int slots;
+    ring_t *in;  /* blocks to free (pipeline mode) */
+    ring_t *out; /* blocks allocated for the next thread (pipeline mode) */
+    bool failed;
+} worker_t;
+
+/* Seconds elapsed on a monotonic clock */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Per-thread xorshift generator, so threads do not share rand() state */
+static unsigned long next_random(unsigned long *state)
+{
+    unsigned long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/* Draw a request size: mostly small, sometimes large */
+static size_t random_size(unsigned long r)
+{
+    return ((r >> 32) % 100 < LARGE_PERCENT) ? 1 + (r >> 16) % LARGE_MAX
+                                             : 1 + (r >> 16) % SMALL_MAX;
+}
+
+/* Append p to the ring unless it is full */
+static bool ring_push(ring_t *ring, char *p)
+{
+    unsigned long tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == RING_SIZE)
+        return false;
+    ring->slot[tail % RING_SIZE] = p;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Take the oldest block off the ring unless it is empty */
+static bool ring_pop(ring_t *ring, char **p)
+{
+    unsigned long head = ring->head;
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+        return false;
+    *p = ring->slot[head % RING_SIZE];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * worker - Run the random malloc/free workload, then free every block that
+ *     is still live.
+ */
+static void *worker(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    unsigned long state = 0x9E3779B97F4A7C15UL * (unsigned long)(w->id + 1);
+    char **slot = calloc(w->slots, sizeof(char *));
+    long i;
+    int s;
+
+    if (slot == NULL)
+    {
+        w->failed = true;
+        return NULL;
+    }
+    for (i = 0; i < w->ops; i++)
+    {
+        unsigned long r = next_random(&state);
+        s = (int)(r % w->slots);
+        if (slot[s] != NULL)
+        {
+            mm_free(slot[s]);
+            slot[s] = NULL;
+            continue;
+        }
+        size_t size = random_size(r);
+        if ((slot[s] = mm_malloc(size)) == NULL)
+        {
+            w->failed = true;
+            break;
+        }
+        /* Touch both ends of the payload */
+        slot[s][0] = (char)i;
+        slot[s][size - 1] = (char)i;
+    }
+    for (s = 0; s < w->slots; s++)
+        mm_free(slot[s]);
+    free(slot);
+    return NULL;
+}
+
+/*
+ * pipeline_worker - Allocate ops/2 blocks for the next thread while freeing
+ *     the blocks handed over by the previous one, until that thread is done.
+ */
+static void *pipeline_worker(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    unsigned long state = 0x9E3779B97F4A7C15UL * (unsigned long)(w->id + 1);
+    char *pending = NULL;
+    long made = 0;
+    char *p;
+
+    for (;;)
+    {
+        bool progress = false;
+        if (pending == NULL && made < w->ops / 2)
+        {
+            size_t size = random_size(next_random(&state));
+            if ((pending = mm_malloc(size)) == NULL)
+            {
+                w->failed = true;
+                made = w->ops / 2;
+            }
+            else
+            {
+                pending[0] = (char)made;
+                pending[size - 1] = (char)made;
+                made++;
+            }
+        }
+        if (pending != NULL && ring_push(w->out, pending))
+        {
+            pending = NULL;
+            progress = true;
+        }
+        if (pending == NULL && made == w->ops / 2)
+            __atomic_store_n(&w->out->done, true, __ATOMIC_RELEASE);
+
+        /* Read done first, so that an empty ring afterwards means the end */
+        bool done = __atomic_load_n(&w->in->done, __ATOMIC_ACQUIRE);
+        if (ring_pop(w->in, &p))
+        {
+            mm_free(p);
+            progress = true;
+        }
+        else if (done && pending == NULL && made == w->ops / 2)
+            break;
+
+        /* Let the neighbours run if both rings are stuck */
+        if (!progress)
+            sched_yield();
+    }
+    return NULL;
+}
+
+/*
+ * run - Time the workload on nthreads threads against a fresh heap.
+ *     Returns the elapsed time in seconds, or a negative value on failure.
+ */
+static double run(int nthreads, long ops, int slots, bool pipeline)
+{
+    pthread_t *tids = calloc(nthreads, sizeof(pthread_t));
+    worker_t *workers = calloc(nthreads, sizeof(worker_t));
+    ring_t *rings = calloc(nthreads, sizeof(ring_t));
+    bool failed = false;
+    double start;
+    int i;
+
+    if (tids == NULL || workers == NULL || rings == NULL)
+    {
+        fprintf(stderr, "calloc failed\n");
+        exit(1);
+    }
+
+    mem_reset_brk();
+    if (!mm_init())
+    {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+
+    start = now();
+    for (i = 0; i < nthreads; i++)
+    {
+        workers[i].id = i;
+        workers[i].ops = ops;
+        workers[i].slots = slots;
+        /* Thread i feeds thread i + 1, and the last one feeds thread 0 */
+        workers[i].out = &rings[i];
+        workers[i].in = &rings[(i + nthreads - 1) % nthreads];
+        if (pthread_create(&tids[i], NULL, pipeline ? pipeline_worker : worker,
+                           &workers[i]) != 0)
+        {
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < nthreads; i++)
+    {
+        pthread_join(tids[i], NULL);
+        failed = failed || workers[i].failed;
+    }
+    double secs = now() - start;
+
+    if (!mm_checkheap(__LINE__))
+    {
+        fprintf(stderr, "mm_checkheap failed after %d threads\n", nthreads);
+        failed = true;
+    }
+    free(tids);
+    free(workers);
+    free(rings);
+    return failed ? -1.0 : secs;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(char *prog)
+{
+    fprintf(stderr, "Usage: %s [-hp] [-t <n>] [-n <ops>] [-s <slots>]\n",
+            prog);
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-p         Pipeline mode: blocks are freed by the "
+                    "next thread.\n");
+    fprintf(stderr, "\t-t <n>     Scale from 1 to <n> threads "
+                    "(default: number of CPUs).\n");
+    fprintf(stderr, "\t-n <ops>   Operations per thread (default %d).\n",
+            DEFAULT_OPS);
+    fprintf(stderr, "\t-s <slots> Live blocks per thread (default %d).\n",
+            DEFAULT_SLOTS);
+}
+
+int main(int argc, char **argv)
+{
+    int max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    long ops = DEFAULT_OPS;
+    int slots = DEFAULT_SLOTS;
+    double base_tput = 0.0;
+    bool pipeline = false;
+    int c;
+
+    while ((c = getopt(argc, argv, "hpt:n:s:")) != EOF)
+    {
+        switch (c)
+        {
+        case 'p':
+            pipeline = true;
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'n':
+            ops = atol(optarg);
+            break;
+        case 's':
+            slots = atoi(optarg);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (max_threads < 1 || ops < 1 || slots < 1)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    mem_init(false);
+    printf("%7s %10s %9s %9s %8s\n", "threads", "ops", "secs", "Kops/s",
+           "speedup");
+    for (int n = 1; n <= max_threads; n++)
+    {
+        double secs = run(n, ops, slots, pipeline);
+        if (secs < 0)
+        {
+            printf("%7d  failed\n", n);
+            mem_deinit();
+            exit(1);
+        }
+        double tput = n * ops / (secs * 1000.0);
+        if (n == 1)
+            base_tput = tput;
+        printf("%7d %10ld %9.3f %9.0f %8.2f\n", n, n * ops, secs, tput,
+               tput / base_tput);
+    }
+    mem_deinit();
+    return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * poolbench.c - Benchmark for the fixed-size pools of mm-pool.c
+ *
+ * Simulates a program like the BDD packages behind the bdd traces, which
+ * make and drop many nodes of one size. A table of slots starts empty;
+ * each step picks a random slot, and frees the node in it if there is one
+ * or allocates a node for it if not. Both ends of every new node are
+ * written. The same steps are run twice against a fresh heap:
+ *
+ *   malloc  every node comes from mm_malloc and goes back to mm_free
+ *   pool    every node comes from mm_pool_alloc and goes back to
+ *           mm_pool_free, and mm_pool_destroy drops the rest at the end
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "mm-pool.h"
+#include "mm.h"
+
+/* Defaults for the command line options */
+#define DEFAULT_STEPS 4000000 /* allocations and frees per run */
+#define DEFAULT_SLOTS 50000   /* slots that may hold a node */
+#define DEFAULT_SIZE 24       /* node size, in bytes */
+#define DEFAULT_REPS 3        /* runs of each mode, the fastest counts */
+
+typedef enum
+{
+    MODE_MALLOC,
+    MODE_POOL
+} bench_mode_t;
+
+/* Parameters of a run */
+typedef struct
+{
+    long steps;
+    int slots;
+    size_t size;
+} params_t;
+
+/* Seconds elapsed on a monotonic clock */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* xorshift generator, so that every mode sees the same steps */
+static unsigned long next_random(unsigned long *state)
+{
+    unsigned long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/*
+ * run - Run every step in the given mode against a fresh heap. Returns the
+ *     elapsed time in seconds, or a negative value on failure.
+ */
+static double run(bench_mode_t mode, const params_t *p)
+{
+    unsigned long state = 0x9E3779B97F4A7C15UL;
+    char **slots = calloc(p->slots, sizeof(char *));
+    struct mm_pool *pool = NULL;
+    bool failed = false;
+    long i;
+    int k;
+
+    if (slots == NULL)
+    {
+        fprintf(stderr, "calloc failed\n");
+        exit(1);
+    }
+
+    mem_reset_brk();
+    if (!mm_init())
+    {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+
+    double start = now();
+    if (mode == MODE_POOL)
+        failed = (pool = mm_pool_create(p->size)) == NULL;
+
+    for (i = 0; i < p->steps && !failed; i++)
+    {
+        k = (int)(next_random(&state) % p->slots);
+        if (slots[k] != NULL)
+        {
+            if (mode == MODE_MALLOC)
+                mm_free(slots[k]);
+            else
+                mm_pool_free(pool, slots[k]);
+            slots[k] = NULL;
+            continue;
+        }
+        slots[k] = mode == MODE_MALLOC ? mm_malloc(p->size)
+                                       : mm_pool_alloc(pool);
+        if (slots[k] == NULL)
+        {
+            failed = true;
+            break;
+        }
+        /* Touch both ends of the node */
+        slots[k][0] = (char)k;
+        slots[k][p->size - 1] = (char)k;
+    }
+
+    if (mode == MODE_MALLOC)
+    {
+        for (k = 0; k < p->slots; k++)
+            mm_free(slots[k]);
+    }
+    else
+        mm_pool_destroy(pool);
+    double secs = now() - start;
+
+    if (!mm_checkheap(__LINE__))
+    {
+        fprintf(stderr, "mm_checkheap failed\n");
+        failed = true;
+    }
+    free(slots);
+    return failed ? -1.0 : secs;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-h] [-n <steps>] [-l <slots>] [-s <bytes>] "
+            "[-R <reps>]\n",
+            prog);
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-n <n>     Allocations and frees per run (default "
+                    "%d).\n",
+            DEFAULT_STEPS);
+    fprintf(stderr, "\t-l <n>     Slots that may hold a node (default %d).\n",
+            DEFAULT_SLOTS);
+    fprintf(stderr, "\t-s <bytes> Node size (default %d).\n", DEFAULT_SIZE);
+    fprintf(stderr, "\t-R <n>     Runs of each mode (default %d).\n",
+            DEFAULT_REPS);
+}
+
+int main(int argc, char **argv)
+{
+    params_t p = {DEFAULT_STEPS, DEFAULT_SLOTS, DEFAULT_SIZE};
+    int reps = DEFAULT_REPS;
+    double base_tput = 0.0;
+    int c;
+
+    while ((c = getopt(argc, argv, "hn:l:s:R:")) != EOF)
+    {
+        switch (c)
+        {
+        case 'n':
+            p.steps = atol(optarg);
+            break;
+        case 'l':
+            p.slots = atoi(optarg);
+            break;
+        case 's':
+            p.size = (size_t)atol(optarg);
+            break;
+        case 'R':
+            reps = atoi(optarg);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (p.steps < 1 || p.slots < 1 || p.size < 1 || reps < 1)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    mem_init(false);
+    printf("%-7s %10s %6s %9s %9s %9s %8s\n", "mode", "steps", "size",
+           "secs", "Kops/s", "peak KiB", "speedup");
+    for (int m = MODE_MALLOC; m <= MODE_POOL; m++)
+    {
+        double best = -1.0;
+        for (int r = 0; r < reps; r++)
+        {
+            double secs = run((bench_mode_t)m, &p);
+            if (secs < 0)
+            {
+                printf("%-7s  failed\n", m == MODE_MALLOC ? "malloc" : "pool");
+                mem_deinit();
+                exit(1);
+            }
+            if (best < 0 || secs < best)
+                best = secs;
+        }
+        double tput = p.steps / (best * 1000.0);
+        if (m == MODE_MALLOC)
+            base_tput = tput;
+        printf("%-7s %10ld %6zu %9.3f %9.0f %9zu %8.2f\n",
+               m == MODE_MALLOC ? "malloc" : "pool", p.steps, p.size, best,
+               tput, mem_heap_peak() / 1024, tput / base_tput);
+    }
+    mem_deinit();
+    return 0;
+}